@@ -56,8 +56,16 @@
 #define MERGE_THRESHOLD (1500)
 #define NUM_ELEMS_AFTER_MERGE (2000)
 
+/* the request buffer is divided into slots, so that the requests of the next
+ * batch can be sent while the DPU executes the current one (the slot is the
+ * operand of TASK_GET, TASK_INSERT and TASK_SUCC) */
+#ifndef NR_REQUEST_SLOTS
+#define NR_REQUEST_SLOTS (2)
+#endif
+
+/* per slot */
 #ifndef MAX_REQ_NUM_IN_A_DPU
-#define MAX_REQ_NUM_IN_A_DPU (MRAM_REQUEST_BUFFER_BYTES / sizeof(each_request_t) / 2)
+#define MAX_REQ_NUM_IN_A_DPU (MRAM_REQUEST_BUFFER_BYTES / sizeof(each_request_t) / 2 / NR_REQUEST_SLOTS)
 #endif
 
 /*
@@ -15,9 +15,9 @@ BARRIER_INIT(my_barrier, NR_TASKLETS);
 #include <barrier.h>
 SEMAPHORE_INIT(my_semaphore, 1);
 
-__mram each_request_t request_buffer[MAX_REQ_NUM_IN_A_DPU];
-__mram int end_idx[NR_SEATS_IN_DPU];
-__mram dpu_results_t results;
+__mram each_request_t request_buffer[NR_REQUEST_SLOTS][MAX_REQ_NUM_IN_A_DPU];
+__mram int end_idx[NR_REQUEST_SLOTS][NR_SEATS_IN_DPU];
+__mram dpu_results_t results[NR_REQUEST_SLOTS];
 __mram_ptr void* ptr;
 __mram KVPair tree_transfer_buffer[MAX_NUM_NODES_IN_SEAT * MAX_CHILD];
 __mram uint64_t tree_transfer_num;
@@ -30,6 +30,7 @@ __host int num_kvpairs_in_seat[NR_SEATS_IN_DPU];
 int queries_per_tasklet;
 seat_id_t current_tree;
 uint32_t task;
+uint32_t slot;  /* request slot of TASK_GET, TASK_INSERT and TASK_SUCC */
 int num_invoked = 0;
 #ifdef PRINT_DISTRIBUTION
 __host int numofnodes[NR_SEATS_IN_DPU];
@@ -44,9 +45,11 @@ int main()
     if (tid == 0) {
         num_invoked++;
         task = (uint32_t) TASK_GET_ID(task_no);
+        /* the operand of TASK_FROM and TASK_TO is a seat */
+        slot = task == TASK_FROM || task == TASK_TO ? 0 : (uint32_t) TASK_GET_OPERAND(task_no);
 #ifdef DEBUG_ON
         for (int t = 0; t < NR_SEATS_IN_DPU; t++) {
-            printf("end_idx[%d] = %d\n", t, end_idx[t]);
+            printf("end_idx[%d] = %d\n", t, end_idx[slot][t]);
         }
 #endif
     }
@@ -77,7 +80,7 @@ int main()
     }
     case TASK_INSERT: {
         if (tid == 0) {
-            queries_per_tasklet = end_idx[NR_SEATS_IN_DPU - 1] / NR_TASKLETS;
+            queries_per_tasklet = end_idx[slot][NR_SEATS_IN_DPU - 1] / NR_TASKLETS;
             current_tree = 0;
             printf("insert task\n");
         }
@@ -93,9 +96,9 @@ int main()
                 while (num_queries < queries_per_tasklet && current_tree < NR_SEATS_IN_DPU) {
                     current_tree++;
                     if (current_tree == 0)
-                        num_queries += end_idx[0];
+                        num_queries += end_idx[slot][0];
                     else
-                        num_queries += end_idx[current_tree] - end_idx[current_tree - 1];
+                        num_queries += end_idx[slot][current_tree] - end_idx[slot][current_tree - 1];
                 }
                 end_tree = current_tree;
             }
@@ -110,8 +113,8 @@ int main()
         /* execution */
         for (seat_id_t tree = start_tree; tree < end_tree; tree++) {
             if (Seat_is_used(tree)) {
-                for (int index = tree == 0 ? 0 : end_idx[tree - 1]; index < end_idx[tree]; index++) {
-                    BPTreeInsert(request_buffer[index].key, request_buffer[index].write_val_ptr, tree);
+                for (int index = tree == 0 ? 0 : end_idx[slot][tree - 1]; index < end_idx[slot][tree]; index++) {
+                    BPTreeInsert(request_buffer[slot][index].key, request_buffer[slot][index].write_val_ptr, tree);
                 }
 #ifdef PRINT_DEBUG
                 sem_take(&my_semaphore);
@@ -129,21 +132,21 @@ int main()
         barrier_wait(&my_barrier);
         // DPU側で負荷分散する
         int start_index = queries_per_tasklet * tid;
-        int end_index = tid == NR_TASKLETS - 1 ? end_idx[NR_SEATS_IN_DPU - 1] : queries_per_tasklet * (tid + 1);
+        int end_index = tid == NR_TASKLETS - 1 ? end_idx[slot][NR_SEATS_IN_DPU - 1] : queries_per_tasklet * (tid + 1);
         int tree = 0;
-        while (end_idx[tree] <= start_index) {
+        while (end_idx[slot][tree] <= start_index) {
             tree++;
         }
         int index = start_index;
         while (true) {
-            if (end_idx[tree] < end_index) { /* not last tree */
-                for (; index < end_idx[tree]; index++) {
-                    results.get.results[index].get_result = BPTreeGet(request_buffer[index].key, tree);
+            if (end_idx[slot][tree] < end_index) { /* not last tree */
+                for (; index < end_idx[slot][tree]; index++) {
+                    results[slot].get.results[index].get_result = BPTreeGet(request_buffer[slot][index].key, tree);
                 }
                 tree++;
             } else { /* last tree */
                 for (; index < end_index; index++) {
-                    results.get.results[index].get_result = BPTreeGet(request_buffer[index].key, tree);
+                    results[slot].get.results[index].get_result = BPTreeGet(request_buffer[slot][index].key, tree);
                 }
                 break;
             }
@@ -175,26 +178,26 @@ int main()
     }
     case TASK_GET: {
         if (tid == 0) {
-            queries_per_tasklet = end_idx[NR_SEATS_IN_DPU - 1] / NR_TASKLETS;
+            queries_per_tasklet = end_idx[slot][NR_SEATS_IN_DPU - 1] / NR_TASKLETS;
         }
         barrier_wait(&my_barrier);
         // DPU側で負荷分散する
         int start_index = queries_per_tasklet * tid;
-        int end_index = tid == NR_TASKLETS - 1 ? end_idx[NR_SEATS_IN_DPU - 1] : queries_per_tasklet * (tid + 1);
+        int end_index = tid == NR_TASKLETS - 1 ? end_idx[slot][NR_SEATS_IN_DPU - 1] : queries_per_tasklet * (tid + 1);
         int tree = 0;
-        while (end_idx[tree] <= start_index) {
+        while (end_idx[slot][tree] <= start_index) {
             tree++;
         }
         int index = start_index;
         while (true) {
-            if (end_idx[tree] < end_index) { /* not last tree */
-                for (; index < end_idx[tree]; index++) {
-                    results.get.results[index].get_result = BPTreeGet(request_buffer[index].key, tree);
+            if (end_idx[slot][tree] < end_index) { /* not last tree */
+                for (; index < end_idx[slot][tree]; index++) {
+                    results[slot].get.results[index].get_result = BPTreeGet(request_buffer[slot][index].key, tree);
                 }
                 tree++;
             } else { /* last tree */
                 for (; index < end_index; index++) {
-                    results.get.results[index].get_result = BPTreeGet(request_buffer[index].key, tree);
+                    results[slot].get.results[index].get_result = BPTreeGet(request_buffer[slot][index].key, tree);
                 }
                 break;
             }
@@ -211,30 +214,30 @@ int main()
     }
     case TASK_SUCC: {
         if (tid == 0) {
-            queries_per_tasklet = end_idx[NR_SEATS_IN_DPU - 1] / NR_TASKLETS;
+            queries_per_tasklet = end_idx[slot][NR_SEATS_IN_DPU - 1] / NR_TASKLETS;
         }
         barrier_wait(&my_barrier);
         // DPU側で負荷分散する
         int start_index = queries_per_tasklet * tid;
-        int end_index = tid == NR_TASKLETS - 1 ? end_idx[NR_SEATS_IN_DPU - 1] : queries_per_tasklet * (tid + 1);
+        int end_index = tid == NR_TASKLETS - 1 ? end_idx[slot][NR_SEATS_IN_DPU - 1] : queries_per_tasklet * (tid + 1);
         int tree = 0;
-        while (end_idx[tree] <= start_index) {
+        while (end_idx[slot][tree] <= start_index) {
             tree++;
         }
         int index = start_index;
         while (true) {
-            if (end_idx[tree] < end_index) { /* not last tree */
-                for (; index < end_idx[tree]; index++) {
-                    KVPair succ = BPTreeSucc(request_buffer[index].key, tree);
-                    results.succ.results[index].succ_key = succ.key;
-                    results.succ.results[index].succ_val_ptr = succ.value;
+            if (end_idx[slot][tree] < end_index) { /* not last tree */
+                for (; index < end_idx[slot][tree]; index++) {
+                    KVPair succ = BPTreeSucc(request_buffer[slot][index].key, tree);
+                    results[slot].succ.results[index].succ_key = succ.key;
+                    results[slot].succ.results[index].succ_val_ptr = succ.value;
                 }
                 tree++;
             } else { /* last tree */
                 for (; index < end_index; index++) {
-                    KVPair succ = BPTreeSucc(request_buffer[index].key, tree);
-                    results.succ.results[index].succ_key = succ.key;
-                    results.succ.results[index].succ_val_ptr = succ.value;
+                    KVPair succ = BPTreeSucc(request_buffer[slot][index].key, tree);
+                    results[slot].succ.results[index].succ_key = succ.key;
+                    results[slot].succ.results[index].succ_val_ptr = succ.value;
                 }
                 break;
             }
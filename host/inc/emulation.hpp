@@ -13,97 +13,22 @@ extern "C" {
 
 #define EMU_MAX_DPUS 2550
 #define EMU_DPUS_IN_RANK 64
-#define EMU_MULTI_THREAD 16 /* nr worker threads */
+#define EMU_MULTI_THREAD /* run DPUs on the thread pool */
 
 #ifdef EMU_MULTI_THREAD
+#include "thread_pool.hpp"
 
-#include <thread>
-#include <condition_variable>
-#include <mutex>
-#include <queue>
-
-class Emulation;
-
-class EmulatorWorkerManager {
-    std::thread* threads[EMU_MULTI_THREAD];
-    bool stop;
-    std::condition_variable cond;
-    std::mutex mtx;
-    std::queue<Emulation*> queue;
-    int nr_running;
-    std::condition_variable  done_cond;
-
-public:
-    EmulatorWorkerManager()
-    {
-        for (int i = 0; i < EMU_MULTI_THREAD; i++)
-            threads[i] = new std::thread([&]{this->run();});
-        nr_running = 0;
-        stop = false;
-    }
-
-    void add_work(Emulation* emu)
-    {
-        std::unique_lock<std::mutex> lk(mtx);
-        queue.push(emu);
-        cond.notify_one();
-    }
-
-    void wait_all()
-    {
-        std::unique_lock<std::mutex> lk(mtx);
-        while (!stop && (nr_running > 0 || !queue.empty()))
-            done_cond.wait(lk);
-    }
-
-    void terminate()
-    {
-        std::unique_lock<std::mutex> lk(mtx);
-        stop = true;
-        cond.notify_all();
-        done_cond.notify_all();
-    }
-
-private:
-    void execute(Emulation* emu);
-
-    void run()
-    {
-        while (true) {
-            std::unique_lock<std::mutex> lk(mtx);
-            while (!stop && queue.empty())
-                cond.wait(lk);
-            if (stop)
-                return;
-            Emulation* emu = queue.front();
-            queue.pop();
-            nr_running++;
-            lk.unlock();
-            execute(emu);
-            lk.lock();
-            nr_running--;
-            if (nr_running == 0 && queue.empty())
-                done_cond.notify_all();
-        }
-    }
-
-};
-
-static EmulatorWorkerManager emu_threads;
-
+/* DPUs being executed */
+static TaskGroup emu_tasks;
 #endif /* EMU_MULTI_THREAD */
 
 class Emulation {
-#ifdef EMU_MULTI_THREAD
-    friend class EmulatorWorkerManager;
-#endif /* EMU_MULTI_THREAD */
-
     struct MRAM {
         uint64_t task_no;
-        int end_idx[NR_SEATS_IN_DPU];
-        each_request_t request_buffer[MAX_REQ_NUM_IN_A_DPU];
+        int end_idx[NR_REQUEST_SLOTS][NR_SEATS_IN_DPU];
+        each_request_t request_buffer[NR_REQUEST_SLOTS][MAX_REQ_NUM_IN_A_DPU];
         merge_info_t merge_info;
-        dpu_results_t results;
+        dpu_results_t results[NR_REQUEST_SLOTS];
         split_info_t split_result[NR_SEATS_IN_DPU];
         int num_kvpairs_in_seat[NR_SEATS_IN_DPU];
         uint64_t tree_transfer_num;
@@ -159,7 +84,7 @@ public:
     void execute()
     {
 #ifdef EMU_MULTI_THREAD
-        emu_threads.add_work(this);
+        thread_pool().submit(emu_tasks, [this] { do_execute(); });
 #else /* EMU_MULTI_THREAD */
         do_execute();
 #endif /* EMU_MULTI_THREAD */
@@ -168,15 +93,13 @@ public:
     static void wait_all()
     {
 #ifdef EMU_MULTI_THREAD
-        emu_threads.wait_all();
+        emu_tasks.wait();
 #endif /* EMU_MULTI_THREAD */
     }
 
     static void terminate()
     {
-#ifdef EMU_MULTI_THREAD
-        emu_threads.terminate();
-#endif /* EMU_MULTI_THREAD */
+        wait_all();
     }
 
 private:
@@ -188,16 +111,17 @@ private:
             task_init();
             break;
         case TASK_INSERT:
-            task_insert();
+            task_insert(TASK_GET_OPERAND(mram.task_no));
 #ifdef DEBUG_ON
-            task_get();
+            task_get(TASK_GET_OPERAND(mram.task_no));
 #endif /* DEBUG_ON */
+            split();
             break;
         case TASK_GET:
-            task_get();
+            task_get(TASK_GET_OPERAND(mram.task_no));
             break;
         case TASK_SUCC:
-            task_succ();
+            task_succ(TASK_GET_OPERAND(mram.task_no));
             break;
         case TASK_FROM:
             task_from(TASK_GET_OPERAND(mram.task_no));
@@ -294,6 +218,8 @@ private:
 
     void split()
     {
+        /* counterpart of clear_split_result */
+        memset(mram.split_result, 0, sizeof(mram.split_result));
         for (int i = 0; i < NR_SEATS_IN_DPU; i++) {
             assert(subtree[i].size() == mram.num_kvpairs_in_seat[i]);
             assert(in_use[i] || mram.num_kvpairs_in_seat[i] == 0);
@@ -334,22 +260,25 @@ private:
         }
     }
 
-    void task_insert()
+    void task_insert(uint32_t slot)
     {
+        const int* end_idx = mram.end_idx[slot];
+        const each_request_t* request_buffer = mram.request_buffer[slot];
+
         /* sanity check */
-        assert(mram.end_idx[0] >= 0);
-        assert(mram.end_idx[0] == 0 || in_use[0]);
+        assert(end_idx[0] >= 0);
+        assert(end_idx[0] == 0 || in_use[0]);
         for (int i = 1; i < NR_SEATS_IN_DPU; i++) {
-            assert(mram.end_idx[i - 1] <= mram.end_idx[i]);
-            assert(mram.end_idx[i - 1] == mram.end_idx[i] || in_use[i]);
+            assert(end_idx[i - 1] <= end_idx[i]);
+            assert(end_idx[i - 1] == end_idx[i] || in_use[i]);
         }
 
         /* insert */
         for (int i = 0, j = 0; i < NR_SEATS_IN_DPU; i++) {
             auto& t = subtree[i];
-            for (; j < mram.end_idx[i]; j++) {
-                key_int64_t key = mram.request_buffer[j].key;
-                value_ptr_t val = mram.request_buffer[j].write_val_ptr;
+            for (; j < end_idx[i]; j++) {
+                key_int64_t key = request_buffer[j].key;
+                value_ptr_t val = request_buffer[j].write_val_ptr;
                 if (t.find(key) == t.end()) {
                     t.insert(std::make_pair(key, val));
                     mram.num_kvpairs_in_seat[i]++;
@@ -358,51 +287,57 @@ private:
                 assert(t.size() == mram.num_kvpairs_in_seat[i]);
             }
         }
-        
-        split();
     }
 
-    void task_get()
+    void task_get(uint32_t slot)
     {
+        const int* end_idx = mram.end_idx[slot];
+        const each_request_t* request_buffer = mram.request_buffer[slot];
+        dpu_results_t& results = mram.results[slot];
+
         /* sanity check */
-        assert(mram.end_idx[0] >= 0);
-        assert(mram.end_idx[0] == 0 || in_use[0]);
+        assert(end_idx[0] >= 0);
+        assert(end_idx[0] == 0 || in_use[0]);
         for (int i = 1; i < NR_SEATS_IN_DPU; i++) {
-            assert(mram.end_idx[i - 1] <= mram.end_idx[i]);
-            assert(mram.end_idx[i - 1] == mram.end_idx[i] || in_use[i]);
+            assert(end_idx[i - 1] <= end_idx[i]);
+            assert(end_idx[i - 1] == end_idx[i] || in_use[i]);
         }
 
         for (int i = 0, j = 0; i < NR_SEATS_IN_DPU; i++)
-            for (; j < mram.end_idx[i]; j++) {
-                key_int64_t key = mram.request_buffer[j].key;
+            for (; j < end_idx[i]; j++) {
+                key_int64_t key = request_buffer[j].key;
                 auto it = subtree[i].lower_bound(key);
                 if (it != subtree[i].end() && it->first == key)
-                    mram.results.get.results[j].get_result = subtree[i].at(key);
+                    results.get.results[j].get_result = subtree[i].at(key);
                 else
-                    mram.results.get.results[j].get_result = 0;
+                    results.get.results[j].get_result = 0;
             }
     }
 
-    void task_succ()
+    void task_succ(uint32_t slot)
     {
+        const int* end_idx = mram.end_idx[slot];
+        const each_request_t* request_buffer = mram.request_buffer[slot];
+        dpu_results_t& results = mram.results[slot];
+
         /* sanity check */
-        assert(mram.end_idx[0] >= 0);
-        assert(mram.end_idx[0] == 0 || in_use[0]);
+        assert(end_idx[0] >= 0);
+        assert(end_idx[0] == 0 || in_use[0]);
         for (int i = 1; i < NR_SEATS_IN_DPU; i++) {
-            assert(mram.end_idx[i - 1] <= mram.end_idx[i]);
-            assert(mram.end_idx[i - 1] == mram.end_idx[i] || in_use[i]);
+            assert(end_idx[i - 1] <= end_idx[i]);
+            assert(end_idx[i - 1] == end_idx[i] || in_use[i]);
         }
 
         for (int i = 0, j = 0; i < NR_SEATS_IN_DPU; i++)
-            for (; j < mram.end_idx[i]; j++) {
-                key_int64_t key = mram.request_buffer[j].key;
+            for (; j < end_idx[i]; j++) {
+                key_int64_t key = request_buffer[j].key;
                 auto it = subtree[i].upper_bound(key);
                 if (it != subtree[i].end()) {
-                    mram.results.succ.results[j].succ_key = it->first;
-                    mram.results.succ.results[j].succ_val_ptr = it->second;
+                    results.succ.results[j].succ_key = it->first;
+                    results.succ.results[j].succ_val_ptr = it->second;
                 } else{
-                    mram.results.succ.results[j].succ_key = 0;
-                    mram.results.succ.results[j].succ_val_ptr = 0;
+                    results.succ.results[j].succ_key = 0;
+                    results.succ.results[j].succ_val_ptr = 0;
                 }
             }
     }
@@ -425,12 +360,4 @@ private:
 
 };
 
-#ifdef EMU_MULTI_THREAD
-void
-EmulatorWorkerManager::execute(Emulation* emu)
-{
-    emu->do_execute();
-}
-#endif /* EMU_MULTI_THREAD */
-
 #endif /* __EMULATION_HPP__ */
\ No newline at end of file
@@ -6,7 +6,10 @@
 #include <cstring>
 #include <cstdio>
 #include <map>
+#include <memory>
 #include "common.h"
+#include "learned_router.hpp"
+#include "routing_index.hpp"
 
 #ifdef PRINT_DEBUG
 #include <cstdio>
@@ -25,15 +28,148 @@ typedef struct seat_addr_t {
     }
 } seat_addr_t;
 
-/* Data structures in host for managing subtrees in DPUs */
+/*
+ * Routing state of the host tree at an epoch.
+ *
+ * A published snapshot is never modified, so preprocessing threads can route
+ * keys with it while the control thread prepares the next epoch from the
+ * results of migration, split and merge. The next snapshot starts as a copy
+ * of the current one (HostTree::writable_snapshot) and becomes current by
+ * HostTree::publish. An old snapshot is freed when the last reader releases
+ * its reference.
+ */
+class RoutingSnapshot
+{
+public:
+    /* which structure is used to route a key to its subtree */
+    enum RouterType {
+        ROUTER_MAP,     /* key_to_tree_map */
+        ROUTER_INDEX,   /* routing_index */
+        ROUTER_LEARNED  /* learned_router */
+    };
+
+    const uint64_t epoch;
+    const RouterType router;
+
+    /* maintained only if router == ROUTER_MAP */
+    std::map<key_int64_t, seat_addr_t> key_to_tree_map;
+
+    /* always maintained; the sort-merge routing scans its upper bounds */
+    RoutingIndex<seat_addr_t> routing_index;
+
+    /* maintained only if router == ROUTER_LEARNED */
+    LearnedRouter<seat_addr_t> learned_router;
+
+    /* the first epoch */
+    RoutingSnapshot(RouterType r, const std::map<key_int64_t, seat_addr_t>& map)
+        : epoch(0), router(r), index_stale(false)
+    {
+        if (router == ROUTER_MAP)
+            key_to_tree_map = map;
+        routing_index.build(map);
+        if (router == ROUTER_LEARNED)
+            learned_router.build(map);
+    }
+
+    /* the epoch next to prev */
+    RoutingSnapshot(const RoutingSnapshot& prev)
+        : epoch(prev.epoch + 1), router(prev.router),
+          key_to_tree_map(prev.key_to_tree_map),
+          routing_index(prev.routing_index),
+          learned_router(prev.learned_router),
+          index_stale(false) {}
+
+    RoutingSnapshot& operator=(const RoutingSnapshot&) = delete;
+
+    /* seat of the subtree whose range contains key */
+    seat_addr_t route(key_int64_t key) const
+    {
+        if (router == ROUTER_INDEX)
+            return routing_index.lookup(key);
+        if (router == ROUTER_LEARNED)
+            return learned_router.lookup(key);
+        auto it = key_to_tree_map.lower_bound(key);
+        return it == key_to_tree_map.end() ? seat_addr_t() : it->second;
+    }
+
+    /* seat of the subtree whose range contains the successor of key */
+    seat_addr_t route_succ(key_int64_t key) const
+    {
+        if (router == ROUTER_INDEX)
+            return routing_index.lookup_succ(key);
+        if (router == ROUTER_LEARNED)
+            return learned_router.lookup_succ(key);
+        auto it = key_to_tree_map.upper_bound(key);
+        return it == key_to_tree_map.end() ? seat_addr_t() : it->second;
+    }
+
+    /*
+     * updates of a snapshot that is not published yet
+     */
+
+    /* migration */
+    void update(key_int64_t ub, seat_addr_t seat)
+    {
+        if (!index_stale)
+            routing_index.update(ub, seat);
+        if (router == ROUTER_MAP)
+            key_to_tree_map[ub] = seat;
+        if (router == ROUTER_LEARNED)
+            learned_router.update(ub, seat);
+    }
+
+    /* split; the routing index is rebuilt by seal() */
+    void split(key_int64_t old_ub, const key_int64_t new_ubs[], const seat_addr_t new_seats[], int n)
+    {
+        index_stale = true;
+        if (router == ROUTER_MAP) {
+            key_to_tree_map.erase(old_ub);
+            for (int i = 0; i < n; i++)
+                key_to_tree_map[new_ubs[i]] = new_seats[i];
+        }
+        if (router == ROUTER_LEARNED)
+            learned_router.split(old_ub, new_ubs, new_seats, n);
+    }
+
+    /* merge; the routing index is rebuilt by seal() */
+    void erase(key_int64_t ub)
+    {
+        index_stale = true;
+        if (router == ROUTER_MAP)
+            key_to_tree_map.erase(ub);
+        if (router == ROUTER_LEARNED)
+            learned_router.erase(ub);
+    }
+
+    /* called just before published; map is the host tree after the updates */
+    void seal(const std::map<key_int64_t, seat_addr_t>& map)
+    {
+        if (index_stale)
+            routing_index.build(map);
+        index_stale = false;
+    }
+
+private:
+    bool index_stale;
+};
+
+/* Data structures in host for managing subtrees in DPUs
+ * (owned by the control thread; other threads use RoutingSnapshot) */
 class HostTree
 {
 public:
     /* host tree: key is the maximum value of the range */
     std::map<key_int64_t, seat_addr_t> key_to_tree_map;
 
-    /* reverse map of host tree */
+    typedef RoutingSnapshot::RouterType RouterType;
+
 private:
+    /* published routing state; accessed with std::atomic_load/store */
+    std::shared_ptr<const RoutingSnapshot> current_snapshot;
+    /* routing state of the next epoch being updated (NULL if no update) */
+    std::unique_ptr<RoutingSnapshot> next_snapshot;
+
+    /* reverse map of host tree */
     key_int64_t tree_to_key_map[NR_DPUS][NR_SEATS_IN_DPU];
 
 public:
@@ -60,6 +196,38 @@ public:
             tree_bitmap[i] = (1ULL << init_trees_per_dpu) - 1;
             num_seats_used[i] = init_trees_per_dpu;
         }
+        set_router(RoutingSnapshot::ROUTER_INDEX);
+    }
+
+    /* start a new series of epochs routed by r */
+    void set_router(RouterType r)
+    {
+        next_snapshot.reset();
+        std::atomic_store(&current_snapshot, std::shared_ptr<const RoutingSnapshot>(new RoutingSnapshot(r, key_to_tree_map)));
+    }
+
+    /* routing state of the current epoch; valid as long as it is held */
+    std::shared_ptr<const RoutingSnapshot> snapshot() const
+    {
+        return std::atomic_load(&current_snapshot);
+    }
+
+    /* routing state of the next epoch (copy on the first update) */
+    RoutingSnapshot& writable_snapshot()
+    {
+        if (!next_snapshot)
+            next_snapshot.reset(new RoutingSnapshot(*current_snapshot));
+        return *next_snapshot;
+    }
+
+    /* make the updates since the last publish visible; returns the new epoch */
+    uint64_t publish()
+    {
+        if (next_snapshot) {
+            next_snapshot->seal(key_to_tree_map);
+            std::atomic_store(&current_snapshot, std::shared_ptr<const RoutingSnapshot>(std::move(next_snapshot)));
+        }
+        return current_snapshot->epoch;
     }
 
     key_int64_t inverse(seat_addr_t seat_addr)
@@ -87,12 +255,14 @@ public:
     }
 
     void apply_migration(Migration* m);
+    void apply_split(seat_addr_t old_sa, const split_info_t& split);
 
     void remove(uint32_t dpu, seat_id_t seat)
     {
         key_int64_t lb = tree_to_key_map[dpu][seat];
         printf("remove (%d, %d) key = 0x%lx\n", dpu, seat, lb);
         key_to_tree_map.erase(lb);
+        writable_snapshot().erase(lb);
         tree_to_key_map[dpu][seat] = 0;
         num_seats_used[dpu]--;
         tree_bitmap[dpu] &= ~(1ULL << seat);
@@ -101,6 +271,14 @@ public:
 private:
 };
 
+/* where a request of a batch is placed in dpu_requests (recorded in packing,
+ * used to gather the results in the order of the requests) */
+#define REQUEST_NOT_SENT UINT32_MAX
+typedef struct request_pos_t {
+    uint32_t dpu;  /* REQUEST_NOT_SENT: SUCC of a key that has no successor */
+    int index;
+} request_pos_t;
+
 /* Data structures in host for managing queries in a batch */
 class BatchCtx
 {
@@ -110,6 +288,8 @@ public:
     int DPU_idx[NR_DPUS]{};
     int num_keys_for_DPU[NR_DPUS]{};
     int num_keys_for_tree[NR_DPUS][NR_SEATS_IN_DPU]{};
+    /* requests to each seat answered by the hot-key cache (not counted above) */
+    int num_hits_for_tree[NR_DPUS][NR_SEATS_IN_DPU]{};
     int send_size{};
     BatchCtx()
     {
@@ -0,0 +1,165 @@
+#ifndef __HOT_KEY_CACHE_HPP__
+#define __HOT_KEY_CACHE_HPP__
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+#include "common.h"
+
+#define HOT_KEY_CACHE_WAYS 4
+#define HOT_KEY_CACHE_MAX_FREQ 15
+
+/*
+ * Values of hot keys cached on the host
+ *
+ * A GET of a cached key is answered by the host without being sent to the
+ * DPUs. The cache is filled with the results of GET, and an INSERT updates
+ * the value of a cached key, so a hit returns what the DPUs would return (a
+ * key without a value is cached as 0, the result of GET for it). Only the
+ * value is cached, not the subtree of the key, so migration, split and merge
+ * do not change the entries.
+ *
+ * The cache is set-associative with HOT_KEY_CACHE_WAYS ways in a set. A way
+ * has a frequency counter, incremented by a hit. A missed key is admitted to
+ * a free way or a way whose counter is 0; otherwise the counters of the set
+ * are decremented, so a key replaces a cached one only if it is missed more
+ * often than the cached one is hit.
+ *
+ * Lookups do not lock: the sequence number of a set is odd while the set is
+ * written, and a lookup that sees it change retries. Writers of a set are
+ * serialized by making the sequence number odd.
+ */
+class HotKeyCache
+{
+    struct Set {
+        std::atomic<uint32_t> seq;
+        std::atomic<uint8_t> valid;  /* bitmap of the ways */
+        std::atomic<uint8_t> freq[HOT_KEY_CACHE_WAYS];
+        std::atomic<key_int64_t> keys[HOT_KEY_CACHE_WAYS];
+        std::atomic<value_ptr_t> values[HOT_KEY_CACHE_WAYS];
+    };
+
+    std::unique_ptr<Set[]> sets;
+    uint64_t mask;  /* number of sets - 1 */
+
+    Set& set_of(key_int64_t key) const
+    {
+        /* keys of a zipfian workload are not uniform in the low bits */
+        uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+        return sets[(h >> 32) & mask];
+    }
+
+    static void lock(Set& s)
+    {
+        uint32_t seq = s.seq.load(std::memory_order_relaxed);
+        while (true) {
+            if ((seq & 1) == 0 && s.seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire))
+                return;
+            seq = s.seq.load(std::memory_order_relaxed);
+        }
+    }
+
+    static void unlock(Set& s)
+    {
+        s.seq.fetch_add(1, std::memory_order_release);
+    }
+
+    static int find(const Set& s, key_int64_t key)
+    {
+        uint8_t valid = s.valid.load(std::memory_order_relaxed);
+        for (int w = 0; w < HOT_KEY_CACHE_WAYS; w++)
+            if ((valid & (1 << w)) && s.keys[w].load(std::memory_order_relaxed) == key)
+                return w;
+        return -1;
+    }
+
+public:
+    /* about entries entries (rounded up to a power of two) */
+    HotKeyCache(size_t entries)
+    {
+        size_t nr_sets = 1;
+        while (nr_sets * HOT_KEY_CACHE_WAYS < entries)
+            nr_sets *= 2;
+        sets.reset(new Set[nr_sets]);
+        mask = nr_sets - 1;
+        for (size_t i = 0; i < nr_sets; i++) {
+            sets[i].seq.store(0, std::memory_order_relaxed);
+            sets[i].valid.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    size_t capacity() const
+    {
+        return (mask + 1) * HOT_KEY_CACHE_WAYS;
+    }
+
+    /* true and the value of key if cached */
+    bool lookup(key_int64_t key, value_ptr_t* value)
+    {
+        Set& s = set_of(key);
+        while (true) {
+            uint32_t seq = s.seq.load(std::memory_order_acquire);
+            if (seq & 1)
+                continue;
+            int w = find(s, key);
+            value_ptr_t v = w >= 0 ? s.values[w].load(std::memory_order_relaxed) : 0;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) != seq)
+                continue;
+            if (w < 0)
+                return false;
+            /* a saturated counter is not written, so hot sets stay shared */
+            uint8_t f = s.freq[w].load(std::memory_order_relaxed);
+            if (f < HOT_KEY_CACHE_MAX_FREQ)
+                s.freq[w].store(f + 1, std::memory_order_relaxed);
+            *value = v;
+            return true;
+        }
+    }
+
+    /* value of key from a DPU; admitted if the key is frequent enough */
+    void fill(key_int64_t key, value_ptr_t value)
+    {
+        Set& s = set_of(key);
+        lock(s);
+        int w = find(s, key);
+        if (w < 0) {
+            uint8_t valid = s.valid.load(std::memory_order_relaxed);
+            for (int i = 0; i < HOT_KEY_CACHE_WAYS && w < 0; i++)
+                if (!(valid & (1 << i)) || s.freq[i].load(std::memory_order_relaxed) == 0)
+                    w = i;
+            if (w < 0) {
+                for (int i = 0; i < HOT_KEY_CACHE_WAYS; i++)
+                    s.freq[i].store(s.freq[i].load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+                unlock(s);
+                return;
+            }
+            s.keys[w].store(key, std::memory_order_relaxed);
+            s.freq[w].store(1, std::memory_order_relaxed);
+            s.valid.store(valid | (1 << w), std::memory_order_relaxed);
+        }
+        s.values[w].store(value, std::memory_order_relaxed);
+        unlock(s);
+    }
+
+    /* key is written with value (the key is not admitted) */
+    void update(key_int64_t key, value_ptr_t value)
+    {
+        Set& s = set_of(key);
+        /* most inserted keys are not cached; check it without locking */
+        uint32_t seq = s.seq.load(std::memory_order_acquire);
+        if ((seq & 1) == 0 && find(s, key) < 0) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) == seq)
+                return;
+        }
+        lock(s);
+        int w = find(s, key);
+        if (w >= 0)
+            s.values[w].store(value, std::memory_order_relaxed);
+        unlock(s);
+    }
+};
+
+#endif /* __HOT_KEY_CACHE_HPP__ */
@@ -0,0 +1,182 @@
+#ifndef __LEARNED_ROUTER_HPP__
+#define __LEARNED_ROUTER_HPP__
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "common.h"
+
+/* maximum error of the position predicted by a segment */
+#ifndef LEARNED_ROUTER_EPSILON
+#define LEARNED_ROUTER_EPSILON 16
+#endif
+
+/*
+ * Piecewise linear model of the position of the upper bounds of the subtrees.
+ *
+ * The sorted upper bounds are covered by segments, each of which predicts
+ * the position of a key in the segment within +-LEARNED_ROUTER_EPSILON.
+ * A lookup finds the segment by a binary search over the first keys of the
+ * segments (there are few because the boundaries are nearly uniform), and
+ * then searches the bounded window around the predicted position.
+ *
+ * Segments are fitted greedily with the shrinking cone algorithm. When a
+ * subtree is split or removed, only the segment containing it is refitted.
+ */
+template <class Seat_t>
+class LearnedRouter
+{
+    struct Segment {
+        key_int64_t first_key;
+        double slope;
+        int start;  /* position of first_key */
+    };
+
+    std::vector<key_int64_t> keys;
+    std::vector<Seat_t> seats;
+    std::vector<Segment> segments;
+
+    /* fit segments to keys[begin, end) */
+    void fit(int begin, int end, std::vector<Segment>& out) const
+    {
+        int i = begin;
+        while (i < end) {
+            Segment seg = {keys[i], 0.0, i};
+            double lo = 0.0, hi = 1e300;
+            int j = i + 1;
+            for (; j < end; j++) {
+                double dx = (double)(keys[j] - seg.first_key);
+                double l = (j - i - LEARNED_ROUTER_EPSILON) / dx;
+                double h = (j - i + LEARNED_ROUTER_EPSILON) / dx;
+                if (l > hi || h < lo)
+                    break;
+                lo = std::max(lo, l);
+                hi = std::min(hi, h);
+            }
+            seg.slope = j == i + 1 ? 0.0 : (lo + hi) / 2;
+            out.push_back(seg);
+            i = j;
+        }
+    }
+
+    /* index of the segment that covers position pos */
+    int segment_of_position(int pos) const
+    {
+        int s = std::upper_bound(segments.begin(), segments.end(), pos,
+                                 [](int p, const Segment& seg) { return p < seg.start; })
+                - segments.begin();
+        return s - 1;
+    }
+
+    /* refit segment s after its range has changed by delta positions */
+    void refit(int s, int delta)
+    {
+        int begin = segments[s].start;
+        int end = (s + 1 < (int)segments.size() ? segments[s + 1].start : (int)keys.size() - delta) + delta;
+        for (size_t t = s + 1; t < segments.size(); t++)
+            segments[t].start += delta;
+        std::vector<Segment> refitted;
+        fit(begin, end, refitted);
+        segments.erase(segments.begin() + s);
+        segments.insert(segments.begin() + s, refitted.begin(), refitted.end());
+    }
+
+public:
+    void build(const std::map<key_int64_t, Seat_t>& map)
+    {
+        keys.clear();
+        seats.clear();
+        for (auto& e : map) {
+            keys.push_back(e.first);
+            seats.push_back(e.second);
+        }
+        segments.clear();
+        fit(0, keys.size(), segments);
+    }
+
+    /* position of the smallest upper bound that is not smaller than key */
+    int find(key_int64_t key) const
+    {
+        const int n = keys.size();
+        int s = std::upper_bound(segments.begin(), segments.end(), key,
+                                 [](key_int64_t k, const Segment& seg) { return k < seg.first_key; })
+                - segments.begin();
+        if (s == 0)
+            return n > 0 ? 0 : -1;
+        const Segment& seg = segments[s - 1];
+        int seg_end = s < (int)segments.size() ? segments[s].start : n;
+        double p = seg.start + seg.slope * (double)(key - seg.first_key);
+        int pred = p < seg_end ? (int)p : seg_end;
+        int lo = std::max(seg.start, pred - LEARNED_ROUTER_EPSILON - 1);
+        int hi = std::min(seg_end, pred + LEARNED_ROUTER_EPSILON + 2);
+        if (lo > hi)
+            lo = hi;
+        int pos = std::lower_bound(&keys[0] + lo, &keys[0] + hi, key) - &keys[0];
+        /* the window is guaranteed by the model up to rounding; fall back */
+        if ((pos == hi && hi < n && keys[hi] < key) || (lo > 0 && keys[lo - 1] >= key))
+            pos = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+        return pos < n ? pos : -1;
+    }
+
+    /* counterpart of key_to_tree_map.lower_bound(key)->second */
+    Seat_t lookup(key_int64_t key) const
+    {
+        int pos = find(key);
+        return pos < 0 ? Seat_t() : seats[pos];
+    }
+
+    /* counterpart of key_to_tree_map.upper_bound(key)->second */
+    Seat_t lookup_succ(key_int64_t key) const
+    {
+        if (key == KEY_MAX)
+            return Seat_t();
+        return lookup(key + 1);
+    }
+
+    /* change the seat of the subtree whose upper bound is ub (migration) */
+    void update(key_int64_t ub, const Seat_t& seat)
+    {
+        int pos = find(ub);
+        assert(pos >= 0 && keys[pos] == ub);
+        seats[pos] = seat;
+    }
+
+    /* replace the subtree whose upper bound is old_ub with n subtrees (split) */
+    void split(key_int64_t old_ub, const key_int64_t new_ubs[], const Seat_t new_seats[], int n)
+    {
+        int pos = find(old_ub);
+        assert(pos >= 0 && keys[pos] == old_ub);
+        int s = segment_of_position(pos);
+        keys.erase(keys.begin() + pos);
+        seats.erase(seats.begin() + pos);
+        keys.insert(keys.begin() + pos, new_ubs, new_ubs + n);
+        seats.insert(seats.begin() + pos, new_seats, new_seats + n);
+        refit(s, n - 1);
+    }
+
+    /* remove the subtree whose upper bound is ub (merge) */
+    void erase(key_int64_t ub)
+    {
+        int pos = find(ub);
+        assert(pos >= 0 && keys[pos] == ub);
+        int s = segment_of_position(pos);
+        keys.erase(keys.begin() + pos);
+        seats.erase(seats.begin() + pos);
+        refit(s, -1);
+    }
+
+    int size() const
+    {
+        return keys.size();
+    }
+
+    int nr_segments() const
+    {
+        return segments.size();
+    }
+};
+
+#endif /* __LEARNED_ROUTER_HPP__ */
@@ -0,0 +1,156 @@
+#ifndef __NUMA_TOPOLOGY_HPP__
+#define __NUMA_TOPOLOGY_HPP__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <assert.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common.h"
+
+#define NUMA_MAX_NODES 64
+#define NUMA_MAX_RANKS 64
+/* memory policy of mbind(2) (numaif.h is not required) */
+#define NUMA_MPOL_PREFERRED 1
+
+/*
+ * NUMA nodes of the host and the node each rank of DPUs is attached to
+ *
+ * The nodes and their CPUs are read from /sys/devices/system/node. The node
+ * of each rank is set by upmem_init (add_rank). The host buffers of a rank
+ * are placed on its node (bind_memory), and a worker of the thread pool is
+ * pinned to the CPUs of a node (pin), so that requests to a rank can be
+ * packed by a worker on the node of the rank.
+ *
+ * With -DEMU_NUMA_NODES=n, the emulator pretends that the host has n nodes
+ * (nodes that do not exist have no CPUs and no memory, so threads and
+ * buffers on them are not bound).
+ */
+class NumaTopology
+{
+    cpu_set_t cpus[NUMA_MAX_NODES];
+    bool has_cpus[NUMA_MAX_NODES];
+
+    static bool read_cpulist(int node, cpu_set_t* set)
+    {
+        char path[64], line[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* fp = fopen(path, "r");
+        if (fp == NULL)
+            return false;
+        bool found = false;
+        CPU_ZERO(set);
+        if (fgets(line, sizeof(line), fp) != NULL) {
+            /* e.g. "0-15,32-47" */
+            char* p = line;
+            while (*p >= '0' && *p <= '9') {
+                int begin = strtol(p, &p, 10);
+                int end = *p == '-' ? strtol(p + 1, &p, 10) : begin;
+                for (int c = begin; c <= end && c < CPU_SETSIZE; c++) {
+                    CPU_SET(c, set);
+                    found = true;
+                }
+                if (*p == ',')
+                    p++;
+            }
+        }
+        fclose(fp);
+        return found;
+    }
+
+public:
+    int nr_nodes;
+    int nr_ranks;
+    int rank_node[NUMA_MAX_RANKS];
+    uint32_t rank_first_dpu[NUMA_MAX_RANKS + 1];
+    int dpu_node[NR_DPUS];
+
+    NumaTopology() : nr_ranks(0)
+    {
+        int n = 0;
+        while (n < NUMA_MAX_NODES && (has_cpus[n] = read_cpulist(n, &cpus[n])))
+            n++;
+#ifdef EMU_NUMA_NODES
+        for (int i = n; i < EMU_NUMA_NODES && i < NUMA_MAX_NODES; i++)
+            has_cpus[i] = false;
+        n = EMU_NUMA_NODES;
+#endif /* EMU_NUMA_NODES */
+        nr_nodes = n > 0 ? (n < NUMA_MAX_NODES ? n : NUMA_MAX_NODES) : 1;
+        rank_first_dpu[0] = 0;
+        memset(dpu_node, 0, sizeof(dpu_node));
+    }
+
+    /* the next rank (DPUs [rank_first_dpu[rank], dpu_end)) is on node */
+    void add_rank(uint32_t dpu_end, int node)
+    {
+        assert(nr_ranks < NUMA_MAX_RANKS);
+        if (node < 0 || node >= nr_nodes)
+            node = 0;
+        rank_node[nr_ranks] = node;
+        for (uint32_t dpu = rank_first_dpu[nr_ranks]; dpu < dpu_end; dpu++)
+            dpu_node[dpu] = node;
+        rank_first_dpu[++nr_ranks] = dpu_end;
+    }
+
+    /* node of the i-th rank of the machine, -1 if unknown */
+    static int read_rank_node(int rank)
+    {
+        char path[80];
+        snprintf(path, sizeof(path), "/sys/class/dpu_rank/dpu_rank%d/numa_node", rank);
+        FILE* fp = fopen(path, "r");
+        if (fp == NULL)
+            return -1;
+        int node = -1;
+        if (fscanf(fp, "%d", &node) != 1)
+            node = -1;
+        fclose(fp);
+        return node;
+    }
+
+    /* pin the calling thread to the CPUs of node */
+    void pin(int node) const
+    {
+        if (nr_nodes > 1 && has_cpus[node])
+            sched_setaffinity(0, sizeof(cpu_set_t), &cpus[node]);
+    }
+
+    /* allocate pages of [addr, addr + size) on node (before they are touched) */
+    void bind_memory(void* addr, size_t size, int node) const
+    {
+        if (nr_nodes <= 1 || !has_cpus[node])
+            return;
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = ((uintptr_t)addr + page - 1) & ~(page - 1);
+        uintptr_t end = ((uintptr_t)addr + size) & ~(page - 1);
+        if (begin >= end)
+            return;
+        unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {};
+        mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+        syscall(SYS_mbind, begin, end - begin, NUMA_MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1, 0);
+    }
+
+    void print(FILE* fp) const
+    {
+        fprintf(fp, "==== NUMA TOPOLOGY (%d node(s)) ====\n", nr_nodes);
+        fprintf(fp, "rank, node, first_dpu, nr_dpus\n");
+        for (int r = 0; r < nr_ranks; r++)
+            fprintf(fp, "%d, %d, %u, %u\n", r, rank_node[r], rank_first_dpu[r],
+                    rank_first_dpu[r + 1] - rank_first_dpu[r]);
+    }
+};
+
+/* the topology (one for the program) */
+inline NumaTopology& numa_topology()
+{
+    static NumaTopology topology;
+    return topology;
+}
+
+#endif /* __NUMA_TOPOLOGY_HPP__ */
@@ -0,0 +1,61 @@
+#ifndef __RADIX_SORT_HPP__
+#define __RADIX_SORT_HPP__
+
+#include <string.h>
+#include <utility>
+
+#include "common.h"
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_NR_DIGITS ((int)(sizeof(key_int64_t) * 8 / RADIX_BITS))
+
+static inline int radix_digit(key_int64_t key, int d)
+{
+    return (key >> (d * RADIX_BITS)) & (RADIX_BUCKETS - 1);
+}
+
+/* bucket of a key in the first (MSD) partitioning pass */
+static inline int radix_top_digit(key_int64_t key)
+{
+    return radix_digit(key, RADIX_NR_DIGITS - 1);
+}
+
+/*
+ * LSD radix sort of keys[0..n) on the lowest nr_digits digits.
+ * tmp must have room for n keys. Passes in which all the keys have the
+ * same digit are skipped, so sorting a bucket of the MSD partitioning
+ * does not pay for the digit it was partitioned by.
+ */
+static inline void radix_sort(key_int64_t* keys, key_int64_t* tmp, int n, int nr_digits = RADIX_NR_DIGITS)
+{
+    static thread_local int hist[RADIX_NR_DIGITS][RADIX_BUCKETS];
+
+    if (n <= 1)
+        return;
+    memset(hist, 0, sizeof(hist[0]) * nr_digits);
+    for (int i = 0; i < n; i++)
+        for (int d = 0; d < nr_digits; d++)
+            hist[d][radix_digit(keys[i], d)]++;
+
+    key_int64_t* src = keys;
+    key_int64_t* dst = tmp;
+    for (int d = 0; d < nr_digits; d++) {
+        int* h = hist[d];
+        if (h[radix_digit(src[0], d)] == n)
+            continue;
+        int acc = 0;
+        for (int b = 0; b < RADIX_BUCKETS; b++) {
+            int c = h[b];
+            h[b] = acc;
+            acc += c;
+        }
+        for (int i = 0; i < n; i++)
+            dst[h[radix_digit(src[i], d)]++] = src[i];
+        std::swap(src, dst);
+    }
+    if (src != keys)
+        memcpy(keys, src, sizeof(key_int64_t) * n);
+}
+
+#endif /* __RADIX_SORT_HPP__ */
@@ -0,0 +1,221 @@
+#ifndef __ROUTING_INDEX_HPP__
+#define __ROUTING_INDEX_HPP__
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif /* __AVX2__ */
+
+#include "common.h"
+
+/*
+ * Static search tree over the upper bounds of the subtrees (S-tree).
+ *
+ * Upper bounds are stored in blocks of ROUTING_INDEX_B keys, one cache line
+ * per block, laid out as an implicit (B+1)-ary tree in BFS order. Block k has
+ * children k * (B + 1) + i + 1 (0 <= i <= B). A lookup visits one block per
+ * level (4 levels for 50k subtrees) and finds the position in each block by
+ * counting the keys smaller than the search key, which is done with two AVX2
+ * compares when available. The seat for the i-th key of block k is stored in
+ * seats[k * B + i], so the result of a lookup is a plain array access.
+ *
+ * Keys are stored with the sign bit flipped so that the signed 64-bit
+ * compare of AVX2 gives the unsigned order.
+ *
+ * The upper bounds and seats are also kept in sorted order for the
+ * sort-merge routing that scans them sequentially (upper_bounds(), seat()).
+ *
+ * Seat_t is the payload type (seat_addr_t in HostTree).
+ */
+
+#define ROUTING_INDEX_B 8
+#define ROUTING_INDEX_NPOS (-1)
+
+template <class Seat_t>
+class RoutingIndex
+{
+    int64_t* keys;  /* [nr_blocks * B], biased, 64-byte aligned */
+    Seat_t* seats;  /* [nr_blocks * B] */
+    key_int64_t* sorted_keys;  /* [nr_keys] */
+    Seat_t* sorted_seats;      /* [nr_keys] */
+    int nr_keys;
+    int nr_blocks;
+    int capacity;   /* in blocks */
+
+    static int64_t bias(key_int64_t key)
+    {
+        return (int64_t)(key ^ (1ULL << 63));
+    }
+
+    static key_int64_t unbias(int64_t key)
+    {
+        return ((key_int64_t)key) ^ (1ULL << 63);
+    }
+
+    static int child(int k, int i)
+    {
+        return k * (ROUTING_INDEX_B + 1) + i + 1;
+    }
+
+    /* number of keys in block k that is smaller than key */
+    int rank(int k, int64_t key) const
+    {
+        const int64_t* block = &keys[k * ROUTING_INDEX_B];
+#ifdef __AVX2__
+        __m256i x = _mm256_set1_epi64x(key);
+        __m256i lo = _mm256_load_si256((const __m256i*)&block[0]);
+        __m256i hi = _mm256_load_si256((const __m256i*)&block[4]);
+        int mlo = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, lo)));
+        int mhi = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, hi)));
+        return __builtin_popcount(mlo | (mhi << 4));
+#else  /* __AVX2__ */
+        int r = 0;
+        for (int i = 0; i < ROUTING_INDEX_B; i++)
+            r += block[i] < key;
+        return r;
+#endif /* __AVX2__ */
+    }
+
+    void reserve(int blocks)
+    {
+        if (blocks <= capacity)
+            return;
+        free(keys);
+        free(seats);
+        free(sorted_keys);
+        free(sorted_seats);
+        capacity = blocks;
+        keys = (int64_t*)aligned_alloc(64, sizeof(int64_t) * ROUTING_INDEX_B * capacity);
+        seats = (Seat_t*)malloc(sizeof(Seat_t) * ROUTING_INDEX_B * capacity);
+        sorted_keys = (key_int64_t*)malloc(sizeof(key_int64_t) * ROUTING_INDEX_B * capacity);
+        sorted_seats = (Seat_t*)malloc(sizeof(Seat_t) * ROUTING_INDEX_B * capacity);
+    }
+
+    /* fill blocks in the in-order of the implicit tree */
+    template <class It>
+    void fill(int k, It& it, It end, const Seat_t& pad_seat)
+    {
+        if (k >= nr_blocks)
+            return;
+        for (int i = 0; i < ROUTING_INDEX_B; i++) {
+            fill(child(k, i), it, end, pad_seat);
+            int pos = k * ROUTING_INDEX_B + i;
+            if (it != end) {
+                keys[pos] = bias(it->first);
+                seats[pos] = it->second;
+                ++it;
+            } else {
+                /* padding is never smaller than any key */
+                keys[pos] = bias(KEY_MAX);
+                seats[pos] = pad_seat;
+            }
+        }
+        fill(child(k, ROUTING_INDEX_B), it, end, pad_seat);
+    }
+
+public:
+    RoutingIndex() : keys(NULL), seats(NULL), sorted_keys(NULL), sorted_seats(NULL),
+                     nr_keys(0), nr_blocks(0), capacity(0) {}
+    RoutingIndex(const RoutingIndex& that)
+        : keys(NULL), seats(NULL), sorted_keys(NULL), sorted_seats(NULL),
+          nr_keys(that.nr_keys), nr_blocks(that.nr_blocks), capacity(0)
+    {
+        reserve(nr_blocks);
+        memcpy(keys, that.keys, sizeof(int64_t) * ROUTING_INDEX_B * nr_blocks);
+        memcpy(seats, that.seats, sizeof(Seat_t) * ROUTING_INDEX_B * nr_blocks);
+        memcpy(sorted_keys, that.sorted_keys, sizeof(key_int64_t) * nr_keys);
+        memcpy(sorted_seats, that.sorted_seats, sizeof(Seat_t) * nr_keys);
+    }
+    RoutingIndex& operator=(const RoutingIndex&) = delete;
+    ~RoutingIndex()
+    {
+        free(keys);
+        free(seats);
+        free(sorted_keys);
+        free(sorted_seats);
+    }
+
+    /* rebuild from the host tree (key: upper bound of the subtree) */
+    void build(const std::map<key_int64_t, Seat_t>& map)
+    {
+        nr_keys = map.size();
+        nr_blocks = (nr_keys + ROUTING_INDEX_B - 1) / ROUTING_INDEX_B;
+        reserve(nr_blocks);
+        int j = 0;
+        for (auto& e : map) {
+            sorted_keys[j] = e.first;
+            sorted_seats[j] = e.second;
+            j++;
+        }
+        auto it = map.begin();
+        Seat_t pad_seat = nr_keys > 0 ? map.rbegin()->second : Seat_t();
+        fill(0, it, map.end(), pad_seat);
+        assert(it == map.end());
+    }
+
+    /* position of the smallest upper bound that is not smaller than key */
+    int find(key_int64_t key) const
+    {
+        int64_t x = bias(key);
+        int res = ROUTING_INDEX_NPOS;
+        int k = 0;
+        while (k < nr_blocks) {
+            int i = rank(k, x);
+            if (i < ROUTING_INDEX_B)
+                res = k * ROUTING_INDEX_B + i;
+            k = child(k, i);
+        }
+        return res;
+    }
+
+    /* counterpart of key_to_tree_map.lower_bound(key)->second */
+    Seat_t lookup(key_int64_t key) const
+    {
+        int pos = find(key);
+        return pos == ROUTING_INDEX_NPOS ? Seat_t() : seats[pos];
+    }
+
+    /* counterpart of key_to_tree_map.upper_bound(key)->second */
+    Seat_t lookup_succ(key_int64_t key) const
+    {
+        if (key == KEY_MAX)
+            return Seat_t();
+        return lookup(key + 1);
+    }
+
+    /* change the seat of the subtree whose upper bound is ub (migration) */
+    void update(key_int64_t ub, const Seat_t& seat)
+    {
+        int pos = find(ub);
+        assert(pos != ROUTING_INDEX_NPOS && unbias(keys[pos]) == ub);
+        seats[pos] = seat;
+        int j = std::lower_bound(sorted_keys, sorted_keys + nr_keys, ub) - sorted_keys;
+        assert(j < nr_keys && sorted_keys[j] == ub);
+        sorted_seats[j] = seat;
+    }
+
+    /* upper bounds in ascending order */
+    const key_int64_t* upper_bounds() const
+    {
+        return sorted_keys;
+    }
+
+    /* seat of the subtree whose upper bound is upper_bounds()[j] */
+    const Seat_t& seat(int j) const
+    {
+        return sorted_seats[j];
+    }
+
+    int size() const
+    {
+        return nr_keys;
+    }
+};
+
+#endif /* __ROUTING_INDEX_HPP__ */
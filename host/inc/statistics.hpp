@@ -1,6 +1,7 @@
 #ifndef __STATISTICS_HPP__
 #define __STATISTICS_HPP__
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <vector>
@@ -18,6 +19,12 @@ class XferStatistics {
     };
     std::map<std::string, std::vector<XferEntry> > stat;
     int epoch = 0;
+    struct BufferEntry {
+        uint64_t bytes = 0;  /* total of the allocations */
+        uint64_t count = 0;
+    };
+    /* (name, pages) -> allocations */
+    std::map<std::pair<std::string, std::string>, BufferEntry> buffers;
 
 public:
     void new_batch()
@@ -42,8 +49,18 @@ public:
         e.count++;
     }
 
+    /* a transfer buffer of bytes is mapped with pages ("1G", "2M", "THP"
+     * (transparent huge pages) or "4K") */
+    void add_buffer(const char* name, const char* pages, uint64_t bytes)
+    {
+        BufferEntry& e = buffers[std::make_pair(std::string(name), std::string(pages))];
+        e.bytes += bytes;
+        e.count++;
+    }
+
     void print(FILE* fp)
     {
+        print_buffers(fp);
         printf("==== XFER STATISTICS (MB) ====\n");
         printf("symbol                    rd count xfer-bytes    average  effective effeciency(%%) \n");
         for (auto x: stat) {
@@ -64,6 +81,15 @@ public:
     }
 
 private:
+    void print_buffers(FILE* fp)
+    {
+        fprintf(fp, "==== XFER BUFFERS (MB) ====\n");
+        fprintf(fp, "buffer                    pages count      bytes\n");
+        for (auto& x: buffers)
+            fprintf(fp, "%-25s %-5s %5lu %10.3f\n", x.first.first.c_str(),
+                    x.first.second.c_str(), x.second.count, x.second.bytes / 1000.0 / 1000.0);
+    }
+
     void print_line(const char* symbol, int rd,
                     uint64_t count, uint64_t total, uint64_t effective)
     {
@@ -79,8 +105,43 @@ private:
     }
 };
 
+/* bytes of host buffers accessed by a thread on the node of the buffer
+ * (local) or on another node (remote) */
+class NumaStatistics {
+public:
+    enum Stage {
+        PACK,    /* requests written by pack_batch */
+        GATHER,  /* results read by the gather stage */
+        NR_STAGES
+    };
+
+    void add(Stage stage, uint64_t local_bytes, uint64_t remote_bytes)
+    {
+        local[stage] += local_bytes;
+        remote[stage] += remote_bytes;
+    }
+
+    void print(FILE* fp)
+    {
+        static const char* names[NR_STAGES] = {"pack", "gather"};
+        fprintf(fp, "==== NUMA STATISTICS (MB) ====\n");
+        fprintf(fp, "stage      local     remote  remote(%%)\n");
+        for (int i = 0; i < NR_STAGES; i++) {
+            uint64_t l = local[i], r = remote[i];
+            fprintf(fp, "%-6s %10.3f %10.3f %10.3f\n", names[i],
+                    l / 1000.0 / 1000.0, r / 1000.0 / 1000.0,
+                    l + r > 0 ? (double)r / (l + r) * 100 : 0.0);
+        }
+    }
+
+private:
+    std::atomic<uint64_t> local[NR_STAGES]{};
+    std::atomic<uint64_t> remote[NR_STAGES]{};
+};
+
 #ifdef MEASURE_XFER_BYTES
 extern XferStatistics xfer_statistics;
+extern NumaStatistics numa_statistics;
 #endif /* MEASURE_XFER_BYTES */   
 
 
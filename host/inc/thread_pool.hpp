@@ -0,0 +1,293 @@
+#ifndef __THREAD_POOL_HPP__
+#define __THREAD_POOL_HPP__
+
+#include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "numa_topology.hpp"
+
+/* number of worker threads, shared by the host and the emulator */
+#ifndef THREAD_POOL_SIZE
+#ifdef HOST_MULTI_THREAD
+#define THREAD_POOL_SIZE HOST_MULTI_THREAD
+#else /* HOST_MULTI_THREAD */
+#define THREAD_POOL_SIZE 16
+#endif /* HOST_MULTI_THREAD */
+#endif /* THREAD_POOL_SIZE */
+
+/*
+ * Tasks submitted together, waited for by TaskGroup::wait
+ */
+class TaskGroup
+{
+    std::mutex mtx;
+    std::condition_variable cond;
+    int nr_tasks = 0;
+
+    friend class ThreadPool;
+
+    void add()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        nr_tasks++;
+    }
+
+    void done()
+    {
+        std::lock_guard<std::mutex> lock{mtx};
+        if (--nr_tasks == 0)
+            cond.notify_all();
+    }
+
+public:
+    void wait();
+};
+
+/*
+ * Work-stealing thread pool
+ *
+ * Each worker has a deque of tasks. A task submitted by a worker is pushed
+ * to its own deque and the owner takes the newest one; tasks submitted by
+ * other threads are distributed round-robin. A worker whose deque is empty
+ * steals the oldest task of another worker, and sleeps when there is no
+ * task at all. A worker waiting for a TaskGroup runs other tasks instead
+ * of sleeping, so tasks may wait for the tasks they submit.
+ *
+ * The workers are divided into contiguous groups, one for each NUMA node,
+ * and pinned to the CPUs of their node (worker_node). submit_to queues a
+ * task to a given worker and binds it to the node of the worker, e.g. the
+ * node of the memory it writes; it is not stolen by workers on other nodes.
+ * Workers steal from the workers on their node first.
+ */
+class ThreadPool
+{
+    struct Task {
+        std::function<void()> f;
+        int node;  /* node the task runs on, or -1 for any */
+    };
+
+    struct Queue {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+    };
+
+    Queue queues[THREAD_POOL_SIZE];
+    std::thread threads[THREAD_POOL_SIZE];
+    std::mutex idle_mtx;
+    std::condition_variable idle_cond;
+    /* queued tasks for any node and for each node (protected by idle_mtx) */
+    int nr_queued = 0;
+    int nr_queued_on[NUMA_MAX_NODES] = {};
+    bool stop = false;
+    std::atomic<unsigned> next_queue{0};
+
+    static int& current_index()
+    {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    bool pop(int i, Task& task)
+    {
+        std::lock_guard<std::mutex> lock{queues[i].mtx};
+        if (queues[i].tasks.empty())
+            return false;
+        task = std::move(queues[i].tasks.back());
+        queues[i].tasks.pop_back();
+        return true;
+    }
+
+    /* the oldest task in queue j that a worker on node can run */
+    bool steal_from(int j, int node, Task& task)
+    {
+        Queue& q = queues[j];
+        std::lock_guard<std::mutex> lock{q.mtx};
+        for (auto it = q.tasks.begin(); it != q.tasks.end(); ++it) {
+            if (it->node < 0 || it->node == node) {
+                task = std::move(*it);
+                q.tasks.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool steal(int i, Task& task)
+    {
+        const int node = worker_node(i);
+        /* pass 0: workers on the same node, pass 1: the others */
+        for (int pass = 0; pass < 2; pass++)
+            for (int k = 1; k < THREAD_POOL_SIZE; k++) {
+                int j = (i + k) % THREAD_POOL_SIZE;
+                if ((worker_node(j) == node) == (pass == 0) && steal_from(j, node, task))
+                    return true;
+            }
+        return false;
+    }
+
+    void taken(const Task& task)
+    {
+        std::lock_guard<std::mutex> lock{idle_mtx};
+        if (task.node < 0)
+            nr_queued--;
+        else
+            nr_queued_on[task.node]--;
+    }
+
+    void run(int i)
+    {
+        const int node = worker_node(i);
+        current_index() = i;
+        numa_topology().pin(node);
+        for (;;) {
+            if (run_one())
+                continue;
+            std::unique_lock<std::mutex> lock{idle_mtx};
+            idle_cond.wait(lock, [&] { return stop || nr_queued > 0 || nr_queued_on[node] > 0; });
+            if (stop && nr_queued <= 0 && nr_queued_on[node] <= 0)
+                return;
+        }
+    }
+
+    template <class F>
+    void push(int i, int node, TaskGroup& group, F f)
+    {
+        group.add();
+        {
+            std::lock_guard<std::mutex> lock{queues[i].mtx};
+            queues[i].tasks.push_back(Task{[&group, f] {
+                f();
+                group.done();
+            }, node});
+        }
+        {
+            std::lock_guard<std::mutex> lock{idle_mtx};
+            if (node < 0)
+                nr_queued++;
+            else
+                nr_queued_on[node]++;
+        }
+        /* a task for a node has to wake a worker on the node */
+        if (node < 0)
+            idle_cond.notify_one();
+        else
+            idle_cond.notify_all();
+    }
+
+public:
+    ThreadPool()
+    {
+        for (int i = 0; i < THREAD_POOL_SIZE; i++)
+            threads[i] = std::thread{[this, i] { run(i); }};
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock{idle_mtx};
+            stop = true;
+        }
+        idle_cond.notify_all();
+        for (auto& t : threads)
+            t.join();
+    }
+
+    /* index of the calling worker, or -1 if it is not a worker */
+    static int worker_index()
+    {
+        return current_index();
+    }
+
+    /* NUMA node of worker i */
+    static int worker_node(int i)
+    {
+        return (int)((int64_t)i * numa_topology().nr_nodes / THREAD_POOL_SIZE);
+    }
+
+    /* the k-th worker on node (wraps around the workers of the node) */
+    static int node_worker(int node, int k)
+    {
+        int nr_nodes = numa_topology().nr_nodes;
+        int begin = (node * THREAD_POOL_SIZE + nr_nodes - 1) / nr_nodes;
+        int end = ((node + 1) * THREAD_POOL_SIZE + nr_nodes - 1) / nr_nodes;
+        return end > begin ? begin + k % (end - begin) : k % THREAD_POOL_SIZE;
+    }
+
+    template <class F>
+    void submit(TaskGroup& group, F f)
+    {
+        int i = worker_index();
+        if (i < 0)
+            i = next_queue++ % THREAD_POOL_SIZE;
+        push(i, -1, group, f);
+    }
+
+    /* run f on worker i, or another worker on its node */
+    template <class F>
+    void submit_to(int i, TaskGroup& group, F f)
+    {
+        push(i, worker_node(i), group, f);
+    }
+
+    /* run a queued task on the calling worker; false if there is none */
+    bool run_one()
+    {
+        int i = worker_index();
+        assert(i >= 0);
+        Task task;
+        if (!pop(i, task) && !steal(i, task))
+            return false;
+        taken(task);
+        task.f();
+        return true;
+    }
+};
+
+/* the pool (one for the program) */
+inline ThreadPool& thread_pool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+inline void TaskGroup::wait()
+{
+    if (ThreadPool::worker_index() >= 0) {
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock{mtx};
+                if (nr_tasks == 0)
+                    return;
+            }
+            if (!thread_pool().run_one())
+                std::this_thread::yield();
+        }
+    }
+    std::unique_lock<std::mutex> lock{mtx};
+    cond.wait(lock, [&] { return nr_tasks == 0; });
+}
+
+/* f(begin, end) for [begin, end) split into chunks of grain; waits for all
+ * (a single chunk is run by the calling thread) */
+template <class F>
+static inline void parallel_for(int begin, int end, int grain, F f)
+{
+    if (end - begin <= grain) {
+        if (begin < end)
+            f(begin, end);
+        return;
+    }
+    TaskGroup group;
+    for (int i = begin; i < end; i += grain) {
+        int e = end - i > grain ? i + grain : end;
+        thread_pool().submit(group, [i, e, &f] { f(i, e); });
+    }
+    group.wait();
+}
+
+#endif /* __THREAD_POOL_HPP__ */
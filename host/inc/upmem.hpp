@@ -4,18 +4,46 @@
 #include "common.h"
 #include "host_data_structures.hpp"
 
-extern dpu_requests_t* dpu_requests;
-extern dpu_results_t* dpu_results;
-extern merge_info_t merge_info[NR_DPUS];
-extern split_info_t split_result[NR_DPUS][NR_SEATS_IN_DPU];
-extern dpu_init_param_t dpu_init_param[NR_DPUS][NR_SEATS_IN_DPU];
+/* results from a DPU in the host buffer */
+typedef union {
+    each_get_result_t* get;
+    each_succ_result_t* succ;
+    void* ptr;
+} dpu_results_ref_t;
 
-void upmem_init(const char* binary, bool is_simulator);
+/* buffers of the current batch for each DPU (laid out by upmem_layout_buffers):
+ * dpu_requests[dpu][i], dpu_results[dpu].get[i], dpu_results[dpu].succ[i] */
+extern each_request_t** dpu_requests;
+extern dpu_results_ref_t* dpu_results;
+/* merge_info[dpu], split_result[dpu][seat], dpu_init_param[dpu][seat]
+ * (allocated by upmem_init) */
+extern merge_info_t* merge_info;
+extern split_info_t (*split_result)[NR_SEATS_IN_DPU];
+extern dpu_init_param_t (*dpu_init_param)[NR_SEATS_IN_DPU];
+
+/* number of sets of dpu_requests/dpu_results (two for pipelining);
+ * buffer i is sent to/received from the request slot i in MRAM */
+#define NR_HOST_BUFFERS NR_REQUEST_SLOTS
+
+void upmem_init(const char* binary, bool is_simulator, int nr_buffers = 1);
 void upmem_release(void);
 uint32_t upmem_get_nr_dpus(void);
+void upmem_use_buffers(int buffer);
+/* allocate the buffers for the number of requests to each DPU
+ * (key_index[dpu][NR_SEATS_IN_DPU]); the previous contents are lost */
+void upmem_layout_buffers(BatchCtx& batch_ctx);
 
 void upmem_send_task(const uint64_t task, BatchCtx& batch_ctx,
                      float* send_time, float* exec_time);
+/* asynchronous version of upmem_send_task */
+void upmem_launch_task(const uint64_t task, BatchCtx& batch_ctx,
+                       float* send_time);
+/* upmem_launch_task in two steps; the requests can be sent to an idle
+ * request slot while the DPUs execute the task in the other slot */
+void upmem_send_requests(const uint64_t task, BatchCtx& batch_ctx,
+                         float* send_time);
+void upmem_launch(const uint64_t task);
+void upmem_wait_task(float* exec_time);
 void upmem_receive_get_results(BatchCtx& batch_ctx, float* receive_time);
 void upmem_receive_succ_results(BatchCtx& batch_ctx, float* receive_time);
 void upmem_receive_split_info(float* receive_time);
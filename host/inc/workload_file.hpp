@@ -0,0 +1,119 @@
+#ifndef __WORKLOAD_FILE_HPP__
+#define __WORKLOAD_FILE_HPP__
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "common.h"
+
+/* batches read ahead of the one being processed */
+#ifndef WORKLOAD_PREFETCH_BATCHES
+#define WORKLOAD_PREFETCH_BATCHES 4
+#endif /* WORKLOAD_PREFETCH_BATCHES */
+
+/*
+ * Keys of the workload file, mapped to memory
+ *
+ * next_batch returns a pointer to the keys of the next batch in the mapping,
+ * so the keys are routed in place without copying them. The mapping is
+ * advised to be read sequentially, and the pages of the next
+ * WORKLOAD_PREFETCH_BATCHES batches are requested ahead (MADV_WILLNEED), so
+ * that the kernel reads them in the background while the current batch is
+ * processed. The keys of a batch stay valid until the file is closed.
+ *
+ * If the file cannot be mapped (e.g. it is a pipe), it is read into a buffer
+ * batch by batch instead.
+ */
+class WorkloadFile
+{
+    int fd;
+    key_int64_t* keys;  /* mapping, or the buffer of a batch */
+    size_t map_size;    /* 0 if not mapped */
+    uint64_t nr_keys;   /* in the mapping */
+    uint64_t pos;       /* first key of the next batch */
+    uint64_t prefetched;  /* keys requested ahead */
+
+    void prefetch(uint64_t end)
+    {
+        end = std::min(end, nr_keys);
+        if (end <= prefetched)
+            return;
+        long page = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = (uintptr_t)&keys[prefetched] & ~(uintptr_t)(page - 1);
+        madvise((void*)begin, (uintptr_t)&keys[end] - begin, MADV_WILLNEED);
+        prefetched = end;
+    }
+
+public:
+    WorkloadFile() : fd(-1), keys(NULL), map_size(0), nr_keys(0), pos(0), prefetched(0) {}
+    WorkloadFile(const WorkloadFile&) = delete;
+    WorkloadFile& operator=(const WorkloadFile&) = delete;
+    ~WorkloadFile()
+    {
+        close();
+    }
+
+    bool open(const char* path)
+    {
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                keys = (key_int64_t*)p;
+                map_size = st.st_size;
+                nr_keys = st.st_size / sizeof(key_int64_t);
+                madvise(p, map_size, MADV_SEQUENTIAL);
+                prefetch((uint64_t)NUM_REQUESTS_PER_BATCH * WORKLOAD_PREFETCH_BATCHES);
+                return true;
+            }
+        }
+        keys = (key_int64_t*)malloc(sizeof(key_int64_t) * NUM_REQUESTS_PER_BATCH);
+        return true;
+    }
+
+    void close()
+    {
+        if (map_size > 0)
+            munmap(keys, map_size);
+        else
+            free(keys);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        keys = NULL;
+        map_size = 0;
+    }
+
+    /* keys of the next batch (up to NUM_REQUESTS_PER_BATCH); returns the
+     * number of keys, 0 at the end of the file */
+    int next_batch(const key_int64_t** batch)
+    {
+        if (map_size > 0) {
+            uint64_t n = std::min((uint64_t)NUM_REQUESTS_PER_BATCH, nr_keys - pos);
+            *batch = &keys[pos];
+            pos += n;
+            prefetch(pos + (uint64_t)NUM_REQUESTS_PER_BATCH * WORKLOAD_PREFETCH_BATCHES);
+            return n;
+        }
+        /* not mapped: the keys of the previous batch are overwritten */
+        size_t size = 0;
+        while (size < sizeof(key_int64_t) * NUM_REQUESTS_PER_BATCH) {
+            ssize_t r = read(fd, (char*)keys + size, sizeof(key_int64_t) * NUM_REQUESTS_PER_BATCH - size);
+            if (r <= 0)
+                break;
+            size += r;
+        }
+        *batch = keys;
+        return size / sizeof(key_int64_t);
+    }
+};
+
+#endif /* __WORKLOAD_FILE_HPP__ */
@@ -5,7 +5,6 @@
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
-#include <fstream>
 #include <iostream>
 #include <limits>
 #include <math.h>
@@ -21,11 +20,15 @@
 #include "cmdline.h"
 #include "common.h"
 #include "host_data_structures.hpp"
+#include "hot_key_cache.hpp"
 #include "migration.hpp"
 #include "node_defs.hpp"
+#include "radix_sort.hpp"
 #include "statistics.hpp"
+#include "thread_pool.hpp"
 #include "upmem.hpp"
 #include "utils.hpp"
+#include "workload_file.hpp"
 
 #define ANSI_COLOR_RED "\x1b[31m"
 #define ANSI_COLOR_GREEN "\x1b[32m"
@@ -44,6 +47,7 @@ float send_time;
 float execution_time;
 float receive_result_time = 0;
 float merge_time;
+float gather_time;
 float batch_time = 0;
 float total_preprocess_time = 0;
 float total_preprocess_time1 = 0;
@@ -54,10 +58,18 @@ float total_send_time = 0;
 float total_execution_time = 0;
 float total_receive_result_time = 0;
 float total_merge_time = 0;
+float total_gather_time = 0;
 float total_batch_time = 0;
 float init_time = 0;
+int cache_hits;
+int send_size_saved;
+uint64_t total_cache_hits = 0;
+uint64_t total_send_size_saved = 0;
 
-key_int64_t* batch_keys;
+const key_int64_t* batch_keys;  /* keys of the batch in the mapped workload file */
+key_int64_t* sorted_keys;
+key_int64_t* sort_scratch;
+HotKeyCache* hot_key_cache;  /* NULL without -c */
 
 #ifdef DEBUG_ON
 std::map<key_int64_t, value_ptr_t> verify_db;
@@ -65,6 +77,7 @@ std::map<key_int64_t, value_ptr_t> verify_db;
 
 #ifdef MEASURE_XFER_BYTES
 XferStatistics xfer_statistics;
+NumaStatistics numa_statistics;
 #endif /* MEASURE_XFER_BYTES */
 
 #ifdef PRINT_DISTRIBUTION
@@ -88,6 +101,11 @@ struct Option {
         a.add<std::string>("print-load", 'q', "print number of queries sent for each seat", false, "");
         a.add<std::string>("print-subtree-size", 'e', "print number of elements for each seat", false, "");
         a.add<std::string>("variant", 'b', "build variant", false, "");
+        a.add<std::string>("router", 'r', "structure to route keys to subtrees ex)map, index, learned", false, "index");
+        a.add<std::string>("preprocess", 'p', "how to route a batch ex)lookup, sortmerge", false, "lookup");
+        a.add("pipeline", 'l', "if declared, the next batch is preprocessed while DPUs execute the current batch");
+        a.add("print-topology", 't', "print the NUMA node of each rank");
+        a.add<int>("cache", 'c', "number of hot keys whose values are cached on the host (0: no cache)", false, 0);
         a.parse_check(argc, argv);
 
         std::string alpha = a.get<std::string>("zipfianconst");
@@ -97,6 +115,9 @@ struct Option {
         nr_total_queries = a.get<int>("keynum");
         nr_migrations_per_batch = a.get<int>("migration_num");
         is_simulator = a.exist("simulator");
+        pipeline = a.exist("pipeline");
+        print_topology = a.exist("print-topology");
+        cache_entries = a.get<int>("cache");
         if (a.get<std::string>("ops") == "get")
             op_type = OP_TYPE_GET;
         else if (a.get<std::string>("ops") == "insert")
@@ -107,6 +128,24 @@ struct Option {
             fprintf(stderr, "invalid operation type: %s\n", a.get<std::string>("ops").c_str());
             exit(1);
         }
+        if (a.get<std::string>("router") == "map")
+            router = RoutingSnapshot::ROUTER_MAP;
+        else if (a.get<std::string>("router") == "index")
+            router = RoutingSnapshot::ROUTER_INDEX;
+        else if (a.get<std::string>("router") == "learned")
+            router = RoutingSnapshot::ROUTER_LEARNED;
+        else {
+            fprintf(stderr, "invalid router: %s\n", a.get<std::string>("router").c_str());
+            exit(1);
+        }
+        if (a.get<std::string>("preprocess") == "lookup")
+            preprocess = PREPROCESS_LOOKUP;
+        else if (a.get<std::string>("preprocess") == "sortmerge")
+            preprocess = PREPROCESS_SORT_MERGE;
+        else {
+            fprintf(stderr, "invalid preprocess mode: %s\n", a.get<std::string>("preprocess").c_str());
+            exit(1);
+        }
 #ifdef HOST_ONLY
         dpu_binary = NULL;
 #else  /* HOST_ONLY */
@@ -154,6 +193,9 @@ struct Option {
     const char* dpu_binary;
     const char* workload_file;
     bool is_simulator;
+    bool pipeline;
+    bool print_topology;
+    int cache_entries;
     float zipfian_const;
     int nr_total_queries;
     int nr_migrations_per_batch;
@@ -162,6 +204,11 @@ struct Option {
         OP_TYPE_INSERT,
         OP_TYPE_SUCC
     } op_type;
+    RoutingSnapshot::RouterType router;
+    enum PreprocessMode {
+        PREPROCESS_LOOKUP,     /* look up the subtree of each key */
+        PREPROCESS_SORT_MERGE  /* sort the batch and merge it with the subtree ranges */
+    } preprocess;
     bool print_load;
     std::pair<int, int> print_load_rc;
     bool print_subtree_size;
@@ -169,38 +216,53 @@ struct Option {
 } opt;
 
 #ifdef DEBUG_ON
-void check_get_results(dpu_results_t* dpu_results, int key_index[NR_DPUS][NR_SEATS_IN_DPU + 1])
+/* run f(dpu_begin, dpu_end) over all DPUs (in parallel if multi-threaded) */
+template <class F>
+static void for_all_dpus(F f)
 {
-    for (uint32_t dpu = 0; dpu < NR_DPUS; dpu++) {
-        for (seat_id_t seat = 0; seat < NR_SEATS_IN_DPU; seat++) {
-            for (int index = seat == 0 ? 0 : key_index[dpu][seat - 1]; index < key_index[dpu][seat]; index++) {
-                key_int64_t key = dpu_requests[dpu].requests[index].key;
-                auto it = verify_db.lower_bound(key);
-                if (it == verify_db.end() || it->first != key)
-                    assert(dpu_results[dpu].get.results[index].get_result == 0);
-                else
-                    assert(dpu_results[dpu].get.results[index].get_result == it->second);
+#ifdef HOST_MULTI_THREAD
+    parallel_for(0, NR_DPUS, 64, f);
+#else  /* HOST_MULTI_THREAD */
+    f(0, NR_DPUS);
+#endif /* HOST_MULTI_THREAD */
+}
+
+void check_get_results(const dpu_results_ref_t* dpu_results, int key_index[NR_DPUS][NR_SEATS_IN_DPU + 1])
+{
+    for_all_dpus([&](uint32_t dpu_begin, uint32_t dpu_end) {
+        for (uint32_t dpu = dpu_begin; dpu < dpu_end; dpu++) {
+            for (seat_id_t seat = 0; seat < NR_SEATS_IN_DPU; seat++) {
+                for (int index = seat == 0 ? 0 : key_index[dpu][seat - 1]; index < key_index[dpu][seat]; index++) {
+                    key_int64_t key = dpu_requests[dpu][index].key;
+                    auto it = verify_db.lower_bound(key);
+                    if (it == verify_db.end() || it->first != key)
+                        assert(dpu_results[dpu].get[index].get_result == 0);
+                    else
+                        assert(dpu_results[dpu].get[index].get_result == it->second);
+                }
             }
         }
-    }
+    });
 }
 
-void check_succ_results(dpu_results_t* dpu_results, int key_index[NR_DPUS][NR_SEATS_IN_DPU + 1], HostTree* host_tree)
+void check_succ_results(const dpu_results_ref_t* dpu_results, int key_index[NR_DPUS][NR_SEATS_IN_DPU + 1], HostTree* host_tree)
 {
-    for (uint32_t dpu = 0; dpu < NR_DPUS; dpu++) {
-        for (seat_id_t seat = 0; seat < NR_SEATS_IN_DPU; seat++) {
-            for (int index = seat == 0 ? 0 : key_index[dpu][seat - 1]; index < key_index[dpu][seat]; index++) {
-                key_int64_t key = dpu_requests[dpu].requests[index].key;
-                auto it = verify_db.upper_bound(key);
-                if (it == verify_db.end()) {
-                    assert(dpu_results[dpu].succ.results[index].succ_val_ptr == 0);
-                } else {
-                    assert(dpu_results[dpu].succ.results[index].succ_key == it->first);
-                    assert(dpu_results[dpu].succ.results[index].succ_val_ptr == it->second);
+    for_all_dpus([&](uint32_t dpu_begin, uint32_t dpu_end) {
+        for (uint32_t dpu = dpu_begin; dpu < dpu_end; dpu++) {
+            for (seat_id_t seat = 0; seat < NR_SEATS_IN_DPU; seat++) {
+                for (int index = seat == 0 ? 0 : key_index[dpu][seat - 1]; index < key_index[dpu][seat]; index++) {
+                    key_int64_t key = dpu_requests[dpu][index].key;
+                    auto it = verify_db.upper_bound(key);
+                    if (it == verify_db.end()) {
+                        assert(dpu_results[dpu].succ[index].succ_val_ptr == 0);
+                    } else {
+                        assert(dpu_results[dpu].succ[index].succ_key == it->first);
+                        assert(dpu_results[dpu].succ[index].succ_val_ptr == it->second);
+                    }
                 }
             }
         }
-    }
+    });
 }
 #endif
 
@@ -248,23 +310,17 @@ void initialize_dpus(int num_init_reqs, HostTree* tree)
 /* update cpu structs according to results of split after insertion from DPUs */
 void update_cpu_struct(HostTree* host_tree)
 {
+    bool split = false;
     for (uint32_t dpu = 0; dpu < NR_DPUS; dpu++) {
         for (seat_id_t old_tree = 0; old_tree < NR_SEATS_IN_DPU; old_tree++) {
             if (split_result[dpu][old_tree].num_split != 0) {
-                seat_addr_t old_sa = seat_addr_t(dpu, old_tree);
-                host_tree->key_to_tree_map.erase(host_tree->inverse(old_sa));
-                host_tree->inv_map_del(old_sa);  // TODO: insearted this line. correct?
-                for (int new_tree = 0; new_tree < split_result[dpu][old_tree].num_split; new_tree++) {
-                    seat_id_t new_seat_id = split_result[dpu][old_tree].new_tree_index[new_tree];
-                    // printf("split: DPU %d seat %d -> seat %d\n", dpu, old_tree, new_seat_id);
-                    key_int64_t ub = split_result[dpu][old_tree].split_key[new_tree];
-                    seat_addr_t new_sa = seat_addr_t(dpu, new_seat_id);
-                    host_tree->key_to_tree_map[ub] = new_sa;
-                    host_tree->inv_map_add(new_sa, ub);
-                }
+                split = true;
+                host_tree->apply_split(seat_addr_t(dpu, old_tree), split_result[dpu][old_tree]);
             }
         }
     }
+    if (split)
+        host_tree->publish();
 }
 
 /* update cpu structs according to merge info */
@@ -275,343 +331,809 @@ void update_cpu_struct_merge(HostTree* host_tree)
         for (seat_id_t i = 0; i < NR_SEATS_IN_DPU; i++)
             if (merge_info[dpu].merge_to[i] != INVALID_SEAT_ID)
                 host_tree->remove(dpu, i);  // merge to the previous subtree
+    host_tree->publish();
 }
 
-int prepare_batch_keys(std::ifstream& file_input, key_int64_t* const batch_keys)
+/* NUMA node of the calling thread (the main thread is counted as node 0) */
+static inline int current_node()
 {
-    file_input.read(reinterpret_cast<char*>(batch_keys), sizeof(key_int64_t) * NUM_REQUESTS_PER_BATCH);
-    return file_input.gcount() / sizeof(key_int64_t);
+    int wi = ThreadPool::worker_index();
+    return wi >= 0 ? ThreadPool::worker_node(wi) : 0;
 }
 
-#ifdef HOST_MULTI_THREAD
-#include <condition_variable>
-#include <mutex>
-#include <thread>
-
-class PreprocessWorker
-{
-    key_int64_t* requests;
-    int start, end;
-    HostTree* host_tree;
-    std::thread t;
-    int count[NR_DPUS][NR_SEATS_IN_DPU];
-    std::condition_variable cond;
-    std::mutex mtx;
-    bool finished = false;
-    void (PreprocessWorker::*job)() = nullptr;
-
-public:
-    PreprocessWorker()
-    {
-        t = std::thread{
-            [this] {
-                std::unique_lock<std::mutex> lock{mtx};
-                for (;;) {
-                    cond.wait(lock, [&] { return finished || job; });
-                    assert(!(finished && job));
-                    if (job) {
-                        (this->*job)();
-                        job = nullptr;
-                    } else {
-                        assert(finished);
-                        break;
-                    }
-                }
-            }};
+int prepare_batch_keys(WorkloadFile& workload, const key_int64_t** batch_keys)
+{
+    return workload.next_batch(batch_keys);
+}
+
+/*
+ * Sort-merge routing (-p sortmerge)
+ *
+ * The batch is sorted into sorted_keys by an MSD pass on the top digit
+ * followed by LSD radix sorts of the buckets (sort_scratch is used as the
+ * scratch area, so batch_keys keeps the order of the requests). The sorted
+ * keys are then merged with the sorted upper bounds of the subtrees, which
+ * splits them into runs of keys that go to the same subtree. The runs are
+ * copied to dpu_requests after migration, so the requests for each seat are
+ * in ascending order. The placement of each sorted key is recorded in
+ * sorted_request_pos, and the placement of each request is found by
+ * searching its key in its bucket of sorted_keys.
+ */
+struct KeyRun {
+    int ub_index;    /* position of the subtree in routing_index of the snapshot
+                      * (not changed by migration) */
+    int begin, end;  /* range in sorted_keys */
+    uint32_t dpu;    /* destination; determined after migration */
+    int dest;
+};
+
+static int sort_bucket_index[RADIX_BUCKETS + 1];
+static request_pos_t sorted_request_pos[NUM_REQUESTS_PER_BATCH];
+
+static void partition_count(const key_int64_t* keys, int begin, int end, int hist[RADIX_BUCKETS])
+{
+    for (int b = 0; b < RADIX_BUCKETS; b++)
+        hist[b] = 0;
+    for (int i = begin; i < end; i++)
+        hist[radix_top_digit(keys[i])]++;
+}
+
+/* offsets: the first index in sorted_keys for each bucket (incremented) */
+static void partition(const key_int64_t* keys, int begin, int end, int offsets[RADIX_BUCKETS])
+{
+    for (int i = begin; i < end; i++) {
+        key_int64_t key = keys[i];
+        sorted_keys[offsets[radix_top_digit(key)]++] = key;
     }
-    ~PreprocessWorker()
-    {
-        {
-            std::unique_lock<std::mutex> lock{mtx};
-            finished = true;
-            cond.notify_one();
-        }
-        t.join();
+}
+
+/* sort buckets [bucket_begin, bucket_end) */
+static void sort_buckets(int bucket_begin, int bucket_end)
+{
+    for (int b = bucket_begin; b < bucket_end; b++) {
+        int begin = sort_bucket_index[b];
+        int end = sort_bucket_index[b + 1];
+        radix_sort(&sorted_keys[begin], &sort_scratch[begin], end - begin, RADIX_NR_DIGITS - 1);
     }
+}
 
-    void initialize(key_int64_t* r, int s, int e, HostTree* h)
-    {
-        for (int i = 0; i < NR_DPUS; i++)
-            for (int j = 0; j < NR_SEATS_IN_DPU; j++)
-                count[i][j] = 0;
-        requests = r;
-        start = s;
-        end = e;
-        host_tree = h;
+/* split sorted_keys[begin, end) into runs of the keys for the same subtree */
+static void merge_join(const RoutingSnapshot* routing, bool succ, int begin, int end, std::vector<KeyRun>& runs)
+{
+    const key_int64_t* ub = routing->routing_index.upper_bounds();
+    const int nr_ubs = routing->routing_index.size();
+    if (begin >= end)
+        return;
+    int j = succ ? std::upper_bound(ub, ub + nr_ubs, sorted_keys[begin]) - ub
+                 : std::lower_bound(ub, ub + nr_ubs, sorted_keys[begin]) - ub;
+    int i = begin;
+    for (; i < end && j < nr_ubs; j++) {
+        int run_begin = i;
+        if (succ)
+            while (i < end && sorted_keys[i] < ub[j])
+                i++;
+        else
+            while (i < end && sorted_keys[i] <= ub[j])
+                i++;
+        if (i > run_begin)
+            runs.push_back(KeyRun{j, run_begin, i, 0, 0});
     }
+    /* the rest has no successor (succ only) */
+    assert(succ || i == end);
+}
 
-private:
-    void count_requests_job()
-    {
-        for (int i = start; i < end; i++) {
-            key_int64_t key = requests[i];
-            auto it = host_tree->key_to_tree_map.lower_bound(key);
-            assert(it != host_tree->key_to_tree_map.end());
-            uint32_t dpu = it->second.dpu;
-            seat_id_t seat = it->second.seat;
-            count[dpu][seat]++;
-        }
+static void add_run_count(const RoutingSnapshot* routing, const std::vector<KeyRun>& runs, int num_keys_for_tree[][NR_SEATS_IN_DPU])
+{
+    for (const KeyRun& r : runs) {
+        const seat_addr_t& sa = routing->routing_index.seat(r.ub_index);
+        num_keys_for_tree[sa.dpu][sa.seat] += r.end - r.begin;
     }
+}
 
-public:
-    void count_requests()
-    {
-        std::lock_guard<std::mutex> lock{mtx};
-        assert(job == nullptr);
-        job = &PreprocessWorker::count_requests_job;
-        cond.notify_one();
+/* key_index: *START* index for each seat (incremented) */
+static void place_runs(const RoutingSnapshot* routing, std::vector<KeyRun>& runs, int key_index[][NR_SEATS_IN_DPU + 1])
+{
+    for (KeyRun& r : runs) {
+        const seat_addr_t& sa = routing->routing_index.seat(r.ub_index);
+        r.dpu = sa.dpu;
+        r.dest = key_index[sa.dpu][sa.seat];
+        key_index[sa.dpu][sa.seat] += r.end - r.begin;
     }
+}
 
-private:
-    void fill_get_requests_job()
-    {
-        for (int i = start; i < end; i++) {
-            key_int64_t key = requests[i];
-            auto it = host_tree->key_to_tree_map.lower_bound(key);
-            assert(it != host_tree->key_to_tree_map.end());
-            uint32_t dpu = it->second.dpu;
-            seat_id_t seat = it->second.seat;
-            int index = count[dpu][seat]++;
-            dpu_requests[dpu].requests[index].key = key;
+static void copy_runs(uint64_t task, const std::vector<KeyRun>& runs)
+{
+#ifdef MEASURE_XFER_BYTES
+    const int node = current_node();
+    uint64_t local = 0, remote = 0;
+    for (const KeyRun& r : runs)
+        (numa_topology().dpu_node[r.dpu] == node ? local : remote) += (r.end - r.begin) * sizeof(each_request_t);
+    numa_statistics.add(NumaStatistics::PACK, local, remote);
+#endif /* MEASURE_XFER_BYTES */
+    for (const KeyRun& r : runs) {
+        each_request_t* req = &dpu_requests[r.dpu][r.dest];
+        for (int i = r.begin; i < r.end; i++, req++) {
+            req->key = sorted_keys[i];
+            if (task == TASK_INSERT)
+                req->write_val_ptr = sorted_keys[i];
+            sorted_request_pos[i] = request_pos_t{r.dpu, r.dest + (i - r.begin)};
         }
     }
-    void fill_insert_requests_job()
-    {
-        for (int i = start; i < end; i++) {
-            key_int64_t key = requests[i];
-            auto it = host_tree->key_to_tree_map.lower_bound(key);
-            assert(it != host_tree->key_to_tree_map.end());
-            uint32_t dpu = it->second.dpu;
-            seat_id_t seat = it->second.seat;
-            int index = count[dpu][seat]++;
-            dpu_requests[dpu].requests[index].key = key;
-            dpu_requests[dpu].requests[index].write_val_ptr = key;
-        }
-    }
-    void fill_succ_requests_job()
-    {
-        for (int i = start; i < end; i++) {
-            key_int64_t key = requests[i];
-            auto it = host_tree->key_to_tree_map.upper_bound(key);
-            if (it != host_tree->key_to_tree_map.end()) {
-                uint32_t dpu = it->second.dpu;
-                seat_id_t seat = it->second.seat;
-                int index = count[dpu][seat]++;
-                dpu_requests[dpu].requests[index].key = key;
-            }
+}
+
+/* placement of batch_keys[begin, end) (the first of the equal keys in sorted_keys) */
+static void locate_requests(const RoutingSnapshot* routing, bool succ, int begin, int end, request_pos_t* request_pos)
+{
+    const int nr_ubs = routing->routing_index.size();
+    /* SUCC of a key not smaller than the last upper bound is not sent */
+    const key_int64_t no_succ = routing->routing_index.upper_bounds()[nr_ubs - 1];
+    for (int i = begin; i < end; i++) {
+        key_int64_t key = batch_keys[i];
+        if (succ && key >= no_succ) {
+            request_pos[i] = request_pos_t{REQUEST_NOT_SENT, 0};
+            continue;
         }
+        int b = radix_top_digit(key);
+        const key_int64_t* p = std::lower_bound(&sorted_keys[sort_bucket_index[b]], &sorted_keys[sort_bucket_index[b + 1]], key);
+        request_pos[i] = sorted_request_pos[p - sorted_keys];
     }
+}
 
-public:
-    void fill_requests(uint64_t task, int end_index[][NR_SEATS_IN_DPU])
-    {
-        for (int i = 0; i < NR_DPUS; i++)
-            for (int j = 0; j < NR_SEATS_IN_DPU; j++) {
-                end_index[i][j] -= count[i][j];
-                count[i][j] = end_index[i][j];
-            }
+#ifdef HOST_MULTI_THREAD
+/*
+ * Lookup routing on the thread pool
+ *
+ * Each key is routed once. The batch is counted in chunks of
+ * ROUTE_CHUNK_KEYS keys, which are taken by the workers of the pool as they
+ * become free. The counting pass records the seat of each key in
+ * batch_routes (as an index of [NR_DPUS][NR_SEATS_IN_DPU]), and the counts
+ * and the chunks in the PreprocessWorker of the worker. The prefix sums are
+ * computed in parallel over the DPUs, and the counts of each worker become
+ * the offsets where it places its requests of the seat. The filling pass
+ * scatters the keys of the chunks of each worker to the DPUs without
+ * routing them again. As the counting pass is done before the migration,
+ * batch_routes holds the seats before the migration, and route_dest_dpu
+ * gives the DPU that the requests to the seat are sent.
+ */
+#define ROUTE_NONE UINT32_MAX
+#define ROUTE_CHUNK_KEYS 4096
+#define ROUTE_CHUNK_DPUS 64
+static uint32_t batch_routes[NUM_REQUESTS_PER_BATCH];
+static uint32_t route_dest_dpu[NR_DPUS * NR_SEATS_IN_DPU];
+static uint64_t route_pass;  /* sequence number of the counting pass */
+
+/* preprocessing state of a worker of the thread pool */
+struct PreprocessWorker
+{
+    /*
+     * lookup routing
+     */
+    uint64_t pass;  /* counting pass that count and chunks belong to */
+    /* number of requests to each seat, then the offset of the next request */
+    int count[NR_DPUS * NR_SEATS_IN_DPU];
+    std::vector<int> chunks;
+
+    /*
+     * sort-merge routing (one partition of the batch each)
+     */
+    int radix_hist[RADIX_BUCKETS];  /* count, then offsets in sorted_keys */
+    std::vector<KeyRun> runs;
+};
 
-        std::lock_guard<std::mutex> lock{mtx};
-        assert(job == nullptr);
-        switch (task) {
-        case TASK_GET:
-            job = &PreprocessWorker::fill_get_requests_job;
-            break;
-        case TASK_INSERT:
-            job = &PreprocessWorker::fill_insert_requests_job;
-            break;
-        case TASK_SUCC:
-            job = &PreprocessWorker::fill_succ_requests_job;
-            break;
-        default:
-            abort();
+static PreprocessWorker ppwk[THREAD_POOL_SIZE];
+/* workers that have taken chunks in the last counting pass */
+static int nr_route_workers;
+static int route_workers[THREAD_POOL_SIZE];
+
+static void count_chunk(int chunk, int num_keys_batch, const RoutingSnapshot* routing, bool succ)
+{
+    /* a batch of a single chunk is counted by the main thread */
+    int wi = ThreadPool::worker_index();
+    PreprocessWorker& w = ppwk[wi >= 0 ? wi : 0];
+    if (w.pass != route_pass) {
+        memset(w.count, 0, sizeof(w.count));
+        w.chunks.clear();
+        w.pass = route_pass;
+    }
+    w.chunks.push_back(chunk);
+    int end = std::min(num_keys_batch, (chunk + 1) * ROUTE_CHUNK_KEYS);
+    for (int i = chunk * ROUTE_CHUNK_KEYS; i < end; i++) {
+        key_int64_t key = batch_keys[i];
+        seat_addr_t sa = succ ? routing->route_succ(key) : routing->route(key);
+        if (sa.seat == INVALID_SEAT_ID) {
+            assert(succ);
+            batch_routes[i] = ROUTE_NONE;
+            continue;
         }
-        cond.notify_one();
+        uint32_t r = sa.dpu * NR_SEATS_IN_DPU + sa.seat;
+        batch_routes[i] = r;
+        w.count[r]++;
     }
+}
 
-    void join()
-    {
-        for (;;) {
-            {
-                std::lock_guard<std::mutex> lock{mtx};
-                if (job == nullptr) {
-                    break;
+/* number of requests to each seat of DPUs [dpu_start, dpu_end) */
+static void sum_counts(uint32_t dpu_start, uint32_t dpu_end, BatchCtx& batch_ctx)
+{
+    for (uint32_t i = dpu_start; i < dpu_end; i++)
+        for (int j = 0; j < NR_SEATS_IN_DPU; j++) {
+            int n = 0;
+            for (int k = 0; k < nr_route_workers; k++)
+                n += ppwk[route_workers[k]].count[i * NR_SEATS_IN_DPU + j];
+            batch_ctx.num_keys_for_tree[i][j] = n;
+        }
+}
+
+/* key_index (end index) of DPUs [dpu_start, dpu_end) after the migration,
+ * and the offsets of each worker for the seats migrated to them */
+static void prefix_sum(uint32_t dpu_start, uint32_t dpu_end, Migration& migration_plan, BatchCtx& batch_ctx)
+{
+    for (uint32_t i = dpu_start; i < dpu_end; i++) {
+        int acc = 0;
+        for (int j = 0; j < NR_SEATS_IN_DPU; j++) {
+            seat_addr_t src = migration_plan.get_source(i, j);
+            if (src.dpu != -1) {
+                uint32_t r = src.dpu * NR_SEATS_IN_DPU + src.seat;
+                route_dest_dpu[r] = i;
+                for (int k = 0; k < nr_route_workers; k++) {
+                    int& c = ppwk[route_workers[k]].count[r];
+                    int n = c;
+                    c = acc;
+                    acc += n;
                 }
             }
-            std::this_thread::yield();
+            batch_ctx.key_index[i][j] = acc;
         }
+        batch_ctx.key_index[i][NR_SEATS_IN_DPU] = acc;
     }
+}
 
-    void add_request_count(int acc_count[][NR_SEATS_IN_DPU])
-    {
-        for (int i = 0; i < NR_DPUS; i++)
-            for (int j = 0; j < NR_SEATS_IN_DPU; j++)
-                acc_count[i][j] += count[i][j];
+/* node >= 0: only the requests to the DPUs on the node */
+static void fill_chunks(PreprocessWorker& w, int num_keys_batch, uint64_t task, request_pos_t* request_pos, int node)
+{
+    const bool insert = task == TASK_INSERT;
+    const int* dpu_node = numa_topology().dpu_node;
+#ifdef MEASURE_XFER_BYTES
+    const int my_node = current_node();
+    uint64_t local = 0, remote = 0;
+#endif /* MEASURE_XFER_BYTES */
+    for (int chunk : w.chunks) {
+        int end = std::min(num_keys_batch, (chunk + 1) * ROUTE_CHUNK_KEYS);
+        for (int i = chunk * ROUTE_CHUNK_KEYS; i < end; i++) {
+            uint32_t r = batch_routes[i];
+            if (r == ROUTE_NONE) {
+                if (node <= 0)
+                    request_pos[i] = request_pos_t{REQUEST_NOT_SENT, 0};
+                continue;
+            }
+            uint32_t dpu = route_dest_dpu[r];
+            if (node >= 0 && dpu_node[dpu] != node)
+                continue;
+            int index = w.count[r]++;
+            each_request_t& req = dpu_requests[dpu][index];
+            req.key = batch_keys[i];
+            if (insert)
+                req.write_val_ptr = batch_keys[i];
+            request_pos[i] = request_pos_t{dpu, index};
+#ifdef MEASURE_XFER_BYTES
+            (dpu_node[dpu] == my_node ? local : remote) += sizeof(each_request_t);
+#endif /* MEASURE_XFER_BYTES */
+        }
     }
-};
+#ifdef MEASURE_XFER_BYTES
+    numa_statistics.add(NumaStatistics::PACK, local, remote);
+#endif /* MEASURE_XFER_BYTES */
+}
 
-PreprocessWorker ppwk[HOST_MULTI_THREAD];
+/* range of the i-th of THREAD_POOL_SIZE partitions of n keys */
+static int partition_begin(int n, int i)
+{
+    return (int)((int64_t)n * i / THREAD_POOL_SIZE);
+}
+#else  /* HOST_MULTI_THREAD */
+static std::vector<KeyRun> key_runs;
 #endif /* HOST_MULTI_THREAD */
 
-int do_one_batch(const uint64_t task, int batch_num, int migrations_per_batch, uint64_t& total_num_keys, const int max_key_num, std::ifstream& file_input, HostTree* host_tree, BatchCtx& batch_ctx)
+static void count_requests_lookup(uint64_t task, int num_keys_batch, const RoutingSnapshot* routing, BatchCtx& batch_ctx)
 {
-#ifdef PRINT_DEBUG
-    printf("======= batch %d =======\n", batch_num);
-#endif /* PRINT_DEBUG */
-    if (dpu_requests == NULL) {
-        printf("[" ANSI_COLOR_RED "ERROR" ANSI_COLOR_RESET
-               "] heap size is not enough\n");
-        return 0;
+#ifdef HOST_MULTI_THREAD
+    bool succ = task == TASK_SUCC;
+    int nr_chunks = (num_keys_batch + ROUTE_CHUNK_KEYS - 1) / ROUTE_CHUNK_KEYS;
+    route_pass++;
+    parallel_for(0, nr_chunks, 1, [&](int chunk, int) {
+        count_chunk(chunk, num_keys_batch, routing, succ);
+    });
+    nr_route_workers = 0;
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+        if (ppwk[i].pass == route_pass)
+            route_workers[nr_route_workers++] = i;
+    parallel_for(0, NR_DPUS, ROUTE_CHUNK_DPUS, [&](int begin, int end) {
+        sum_counts(begin, end, batch_ctx);
+    });
+#else  /* HOST_MULTI_THREAD */
+    for (int i = 0; i < num_keys_batch; i++) {
+        //printf("i: %d, batch_keys[i]:%ld\n", i, batch_keys[i]);
+        seat_addr_t sa = routing->route(batch_keys[i]);
+        if (sa.seat != INVALID_SEAT_ID) {
+            batch_ctx.num_keys_for_tree[sa.dpu][sa.seat]++;
+        } else {
+            printf("ERROR: the key is out of range 3: 0x%lx\n", batch_keys[i]);
+        }
     }
-    int num_migration;
-
-#ifdef MEASURE_XFER_BYTES
-    xfer_statistics.new_batch();
-#endif /* MEASURE_XFER_BYTES */
+#endif /* HOST_MULTI_THREAD */
+}
 
-    if (batch_num == 0) {
-        num_migration = 0;  // batch 0: no migration
+/* request_pos: placement of each request (output) */
+static void fill_requests_lookup(uint64_t task, int num_keys_batch, const RoutingSnapshot* routing, Migration& migration_plan, BatchCtx& batch_ctx, request_pos_t* request_pos)
+{
+#ifdef HOST_MULTI_THREAD
+    /* 4.1 key_index
+     * - *END* index of the queries to the j-th seat of the i-th DPU
+     * - key_index[NR_SEATS_IN_DPU]: number of queries to the DPU
+     */
+    parallel_for(0, NR_DPUS, ROUTE_CHUNK_DPUS, [&](int begin, int end) {
+        prefix_sum(begin, end, migration_plan, batch_ctx);
+    });
+    upmem_layout_buffers(batch_ctx);
+    /* 4.2. make requests to send to DPUs (routed by count_requests_lookup)
+     * With more than one NUMA node, the requests to the DPUs on a node are
+     * made by the workers on the node. */
+    const int nr_nodes = numa_topology().nr_nodes;
+    if (nr_nodes == 1) {
+        parallel_for(0, nr_route_workers, 1, [&](int k, int) {
+            fill_chunks(ppwk[route_workers[k]], num_keys_batch, task, request_pos, -1);
+        });
     } else {
-        num_migration = migrations_per_batch;
+        TaskGroup group;
+        for (int k = 0; k < nr_route_workers; k++)
+            for (int node = 0; node < nr_nodes; node++)
+                thread_pool().submit_to(ThreadPool::node_worker(node, k), group, [=] {
+                    fill_chunks(ppwk[route_workers[k]], num_keys_batch, task, request_pos, node);
+                });
+        group.wait();
     }
-
-    /* 0. read workload file */
-    const int num_keys_batch = prepare_batch_keys(file_input, batch_keys);
-    if (num_keys_batch == 0) {
-        return 0;
+#ifdef DEBUG_ON
+    if (task == TASK_INSERT)
+        for (int i = 0; i < num_keys_batch; i++)
+            verify_db.insert(std::make_pair(batch_keys[i], batch_keys[i]));
+#endif /* DEBUG_ON */
+#else  /* HOST_MULTI_THREAD */
+    /* 4.1 key_index (starting index for queries to the j-th seat of the i-th DPU) */
+    for (uint32_t i = 0; i < NR_DPUS; i++) {
+        batch_ctx.key_index[i][0] = 0;
+        for (seat_id_t j = 1; j <= NR_SEATS_IN_DPU; j++) {
+            batch_ctx.key_index[i][j] = batch_ctx.key_index[i][j - 1] + migration_plan.get_num_queries_for_source(batch_ctx, i, j - 1);
+        }
     }
 
-    /* 1. count number of queries for each DPU, tree */
-#ifdef HOST_MULTI_THREAD
-        for (int i = 0; i < HOST_MULTI_THREAD; i++) {
-            int start = num_keys_batch * i / HOST_MULTI_THREAD;
-            int end = num_keys_batch * (i + 1) / HOST_MULTI_THREAD;
-            ppwk[i].initialize(batch_keys, start, end, host_tree);
-            ppwk[i].count_requests();
+    upmem_layout_buffers(batch_ctx);
+    /* 4.2. make requests to send to DPUs*/
+    switch (task) {
+    case TASK_GET:
+        for (int i = 0; i < num_keys_batch; i++) {
+            seat_addr_t sa = routing->route(batch_keys[i]);
+            assert(sa.seat != INVALID_SEAT_ID);
+            uint32_t dpu = sa.dpu;
+            seat_id_t seat = sa.seat;
+            /* key_index is incremented here, so batch_ctx.key_index[i][j] represents
+            * the first index for seat j in DPU i BEFORE this for loop, then
+            * the first index for seat j+1 in DPU i AFTER this for loop. */
+            int index = batch_ctx.key_index[dpu][seat]++;
+            each_request_t& req = dpu_requests[dpu][index];
+            req.key = batch_keys[i];
+            request_pos[i] = request_pos_t{dpu, index};
         }
-        for (int i = 0; i < HOST_MULTI_THREAD; i++) {
-            ppwk[i].join();
-            ppwk[i].add_request_count(batch_ctx.num_keys_for_tree);
+        break;
+    case TASK_INSERT:
+        for (int i = 0; i < num_keys_batch; i++) {
+            seat_addr_t sa = routing->route(batch_keys[i]);
+            assert(sa.seat != INVALID_SEAT_ID);
+            uint32_t dpu = sa.dpu;
+            seat_id_t seat = sa.seat;
+            /* key_index is incremented here, so batch_ctx.key_index[i][j] represents
+            * the first index for seat j in DPU i BEFORE this for loop, then
+            * the first index for seat j+1 in DPU i AFTER this for loop. */
+            int index = batch_ctx.key_index[dpu][seat]++;
+            each_request_t& req = dpu_requests[dpu][index];
+            req.key = batch_keys[i];
+            req.write_val_ptr = batch_keys[i];
+            request_pos[i] = request_pos_t{dpu, index};
+#ifdef DEBUG_ON
+            verify_db.insert(std::make_pair(batch_keys[i], batch_keys[i]));
+#endif /* DEBUG_ON */
         }
-#else  /* HOST_MULTI_THREAD */
+        break;
+    case TASK_SUCC:
         for (int i = 0; i < num_keys_batch; i++) {
-            //printf("i: %d, batch_keys[i]:%ld\n", i, batch_keys[i]);
-            auto it = host_tree->key_to_tree_map.lower_bound(batch_keys[i]);
-            if (it != host_tree->key_to_tree_map.end()) {
-                uint32_t dpu = it->second.dpu;
-                seat_id_t seat = it->second.seat;
-                batch_ctx.num_keys_for_tree[dpu][seat]++;
+            seat_addr_t sa = routing->route_succ(batch_keys[i]);
+            if (sa.seat != INVALID_SEAT_ID) {
+                uint32_t dpu = sa.dpu;
+                seat_id_t seat = sa.seat;
+                /* key_index is incremented here, so batch_ctx.key_index[i][j] represents
+                * the first index for seat j in DPU i BEFORE this for loop, then
+                * the first index for seat j+1 in DPU i AFTER this for loop. */
+                int index = batch_ctx.key_index[dpu][seat]++;
+                each_request_t& req = dpu_requests[dpu][index];
+                req.key = batch_keys[i];
+                request_pos[i] = request_pos_t{dpu, index};
             } else {
-                printf("ERROR: the key is out of range 3: 0x%lx\n", batch_keys[i]);
+                request_pos[i] = request_pos_t{REQUEST_NOT_SENT, 0};
             }
         }
+        break;
+    default:
+        abort();
+    }
+#ifdef MEASURE_XFER_BYTES
+    uint64_t local = 0, remote = 0;
+    for (uint32_t dpu = 0; dpu < NR_DPUS; dpu++)
+        (numa_topology().dpu_node[dpu] == current_node() ? local : remote) += batch_ctx.key_index[dpu][NR_SEATS_IN_DPU] * sizeof(each_request_t);
+    numa_statistics.add(NumaStatistics::PACK, local, remote);
+#endif /* MEASURE_XFER_BYTES */
 #endif /* HOST_MULTI_THREAD */
+}
 
-    /* 2. migration planning */
-    Migration migration_plan(host_tree);
-    migration_plan_time = measure_time([&] {
-        migration_plan.migration_plan_memory_balancing();
-        migration_plan.migration_plan_query_balancing(batch_ctx, num_migration);
-    }).count();
+/* sort batch_keys into sorted_keys (does not depend on the routing) */
+static void sort_requests(int num_keys_batch)
+{
+#ifdef HOST_MULTI_THREAD
+    parallel_for(0, THREAD_POOL_SIZE, 1, [&](int i, int) {
+        partition_count(batch_keys, partition_begin(num_keys_batch, i),
+                        partition_begin(num_keys_batch, i + 1), ppwk[i].radix_hist);
+    });
+    /* bucket-major, partition-minor order keeps the partitioning stable */
+    int acc = 0;
+    for (int b = 0; b < RADIX_BUCKETS; b++) {
+        sort_bucket_index[b] = acc;
+        for (int i = 0; i < THREAD_POOL_SIZE; i++) {
+            int c = ppwk[i].radix_hist[b];
+            ppwk[i].radix_hist[b] = acc;
+            acc += c;
+        }
+    }
+    sort_bucket_index[RADIX_BUCKETS] = acc;
+    parallel_for(0, THREAD_POOL_SIZE, 1, [&](int i, int) {
+        partition(batch_keys, partition_begin(num_keys_batch, i),
+                  partition_begin(num_keys_batch, i + 1), ppwk[i].radix_hist);
+    });
+    /* buckets are taken one by one, as their sizes are skewed */
+    parallel_for(0, RADIX_BUCKETS, 1, sort_buckets);
+#else  /* HOST_MULTI_THREAD */
+    static int offsets[RADIX_BUCKETS];
+    partition_count(batch_keys, 0, num_keys_batch, offsets);
+    int acc = 0;
+    for (int b = 0; b < RADIX_BUCKETS; b++) {
+        sort_bucket_index[b] = acc;
+        acc += offsets[b];
+        offsets[b] = sort_bucket_index[b];
+    }
+    sort_bucket_index[RADIX_BUCKETS] = acc;
+    partition(batch_keys, 0, num_keys_batch, offsets);
+    sort_buckets(0, RADIX_BUCKETS);
+#endif /* HOST_MULTI_THREAD */
+}
 
-    /* 3. execute migration according to migration_plan */
-    migration_time = measure_time([&] {
-        migration_plan.execute();
-        host_tree->apply_migration(&migration_plan);
-    }).count();
+/* merge sorted_keys with the upper bounds of the subtrees and count the keys */
+static void count_requests_sort_merge(uint64_t task, int num_keys_batch, const RoutingSnapshot* routing, BatchCtx& batch_ctx)
+{
+    bool succ = task == TASK_SUCC;
+#ifdef HOST_MULTI_THREAD
+    parallel_for(0, THREAD_POOL_SIZE, 1, [&](int i, int) {
+        ppwk[i].runs.clear();
+        merge_join(routing, succ, partition_begin(num_keys_batch, i),
+                   partition_begin(num_keys_batch, i + 1), ppwk[i].runs);
+    });
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+        add_run_count(routing, ppwk[i].runs, batch_ctx.num_keys_for_tree);
+#else  /* HOST_MULTI_THREAD */
+    key_runs.clear();
+    merge_join(routing, succ, 0, num_keys_batch, key_runs);
+    add_run_count(routing, key_runs, batch_ctx.num_keys_for_tree);
+#endif /* HOST_MULTI_THREAD */
+}
+
+/* request_pos: placement of each request (output) */
+static void fill_requests_sort_merge(uint64_t task, int num_keys_batch, const RoutingSnapshot* routing, Migration& migration_plan, BatchCtx& batch_ctx, request_pos_t* request_pos)
+{
+    bool succ = task == TASK_SUCC;
+
+    /* 4.1 key_index (starting index for queries to the j-th seat of the i-th DPU) */
+    for (uint32_t i = 0; i < NR_DPUS; i++) {
+        batch_ctx.key_index[i][0] = 0;
+        for (seat_id_t j = 1; j <= NR_SEATS_IN_DPU; j++) {
+            batch_ctx.key_index[i][j] = batch_ctx.key_index[i][j - 1] + migration_plan.get_num_queries_for_source(batch_ctx, i, j - 1);
+        }
+    }
 
-    /* 4. prepare requests to send to DPUs */
-    preprocess_time2 = measure_time([&] {
+    upmem_layout_buffers(batch_ctx);
+    /* 4.2. make requests to send to DPUs; key_index becomes the end index */
 #ifdef HOST_MULTI_THREAD
-        /* 4.1 key_index
-         * - *END* index of the queries to the j-th seat of the i-th DPU
-         * - key_index[NR_SEATS_IN_DPU]: number of queries to the DPU
-         */
-        for (int i = 0; i < NR_DPUS; i++) {
-            int acc = migration_plan.get_num_queries_for_source(batch_ctx, i, 0);
-            batch_ctx.key_index[i][0] = acc;
-            for (int j = 1; j < NR_SEATS_IN_DPU; j++) {
-                acc += migration_plan.get_num_queries_for_source(batch_ctx, i, j);
-                batch_ctx.key_index[i][j] = acc;
-            }
-            batch_ctx.key_index[i][NR_SEATS_IN_DPU] = acc;
-        }
-        /* 4.2. make requests to send to DPUs*/
-        static int end_index[NR_DPUS][NR_SEATS_IN_DPU];
-        for (int i = 0; i < NR_DPUS; i++)
-            for (int j = 0; j < NR_SEATS_IN_DPU; j++)
-                end_index[i][j] = batch_ctx.key_index[i][j];
-        for (int i = HOST_MULTI_THREAD - 1; i >= 0; i--)
-            ppwk[i].fill_requests(task, end_index);
-        for (int i = HOST_MULTI_THREAD - 1; i >= 0; i--)
-            ppwk[i].join();
+    for (int i = 0; i < THREAD_POOL_SIZE; i++)
+        place_runs(routing, ppwk[i].runs, batch_ctx.key_index);
+    parallel_for(0, THREAD_POOL_SIZE, 1, [&](int i, int) {
+        copy_runs(task, ppwk[i].runs);
+    });
+    parallel_for(0, THREAD_POOL_SIZE, 1, [&](int i, int) {
+        locate_requests(routing, succ, partition_begin(num_keys_batch, i),
+                        partition_begin(num_keys_batch, i + 1), request_pos);
+    });
+#else  /* HOST_MULTI_THREAD */
+    place_runs(routing, key_runs, batch_ctx.key_index);
+    copy_runs(task, key_runs);
+    locate_requests(routing, succ, 0, num_keys_batch, request_pos);
+#endif /* HOST_MULTI_THREAD */
 #ifdef DEBUG_ON
-        if (task == TASK_INSERT)
-            for (int i = 0; i < num_keys_batch; i++)
-                verify_db.insert(std::make_pair(batch_keys[i], batch_keys[i]));
+    if (task == TASK_INSERT)
+        for (int i = 0; i < sort_bucket_index[RADIX_BUCKETS]; i++)
+            verify_db.insert(std::make_pair(sorted_keys[i], sorted_keys[i]));
 #endif /* DEBUG_ON */
-#else  /* HOST_MULTI_THREAD */
-        /* 4.1 key_index (starting index for queries to the j-th seat of the i-th DPU) */
-        for (uint32_t i = 0; i < NR_DPUS; i++) {
-            batch_ctx.key_index[i][0] = 0;
-            for (seat_id_t j = 1; j <= NR_SEATS_IN_DPU; j++) {
-                batch_ctx.key_index[i][j] = batch_ctx.key_index[i][j - 1] + migration_plan.get_num_queries_for_source(batch_ctx, i, j - 1);
-            }
-        }
+}
+
+/*
+ * A batch in flight
+ *
+ * A batch goes through read_batch, pack_batch, issue_batch and
+ * complete_batch. complete_batch gathers the results of GET and SUCC into
+ * get_results/succ_results in the order of the requests, with the placement
+ * recorded by pack_batch. The requests answered by the hot-key cache are not
+ * routed; batch_keys holds the other num_routed keys. do_one_batch runs them in this order; the pipelined
+ * executor (-l, run_pipeline) reads and packs the next batch while the DPUs
+ * execute the current one, so it keeps two BatchSlots with their own host
+ * buffers (upmem_use_buffers) and request slots in MRAM.
+ */
+struct BatchSlot {
+    int buffer;  /* dpu_requests/dpu_results used by the batch */
+    uint64_t task;
+    int num_keys;    /* requests in the batch */
+    int num_routed;  /* keys in batch_keys (requests sent to the DPUs) */
+    BatchCtx* batch_ctx;
+    std::unique_ptr<Migration> migration_plan;
+    uint64_t epoch;  /* routing epoch the requests are counted with */
+    bool packed;     /* requests are filled */
+    bool sent;       /* requests are in the request slot in MRAM */
+    request_pos_t* request_pos;  /* [num_routed] */
+    int* request_index;          /* [num_routed]: request of a key in batch_keys
+                                  * (NULL: every request is routed) */
+    each_get_result_t* get_results;    /* [num_keys] (TASK_GET) */
+    each_succ_result_t* succ_results;  /* [num_keys] (TASK_SUCC) */
+    int cache_hits;
+    int send_size_saved;  /* by the cache (estimated) */
+    float preprocess_time1;
+    float preprocess_time2;
+    float migration_plan_time;
+    float migration_time;
+    float send_time;
+    float execution_time;
+    float receive_result_time;
+    float merge_time;
+    float gather_time;
+};
+
+/* results of the batches in the order of the requests (one for each buffer) */
+static request_pos_t batch_request_pos[NR_HOST_BUFFERS][NUM_REQUESTS_PER_BATCH];
+static each_get_result_t batch_get_results[NR_HOST_BUFFERS][NUM_REQUESTS_PER_BATCH];
+static each_succ_result_t batch_succ_results[NR_HOST_BUFFERS][NUM_REQUESTS_PER_BATCH];
+
+/* keys of the batches routed to the DPUs, if some requests are answered by
+ * the hot-key cache */
+static key_int64_t batch_routed_keys[NR_HOST_BUFFERS][NUM_REQUESTS_PER_BATCH];
+static int batch_request_index[NR_HOST_BUFFERS][NUM_REQUESTS_PER_BATCH];
+
+static void init_batch_slot(BatchSlot& s, int buffer, uint64_t task, BatchCtx* batch_ctx)
+{
+    s.buffer = buffer;
+    s.task = task;
+    s.batch_ctx = batch_ctx;
+    s.request_pos = batch_request_pos[buffer];
+    s.get_results = batch_get_results[buffer];
+    s.succ_results = batch_succ_results[buffer];
+}
 
-        /* 4.2. make requests to send to DPUs*/
-        switch (task) {
-        case TASK_GET:
-            for (int i = 0; i < num_keys_batch; i++) {
-                auto it = host_tree->key_to_tree_map.lower_bound(batch_keys[i]);
-                assert(it != host_tree->key_to_tree_map.end());
-                uint32_t dpu = it->second.dpu;
-                seat_id_t seat = it->second.seat;
-                /* key_index is incremented here, so batch_ctx.key_index[i][j] represents
-                * the first index for seat j in DPU i BEFORE this for loop, then
-                * the first index for seat j+1 in DPU i AFTER this for loop. */
-                int index = batch_ctx.key_index[dpu][seat]++;
-                each_request_t& req = dpu_requests[dpu].requests[index];
-                req.key = batch_keys[i];
-            }
-            break;
-        case TASK_INSERT:
-            for (int i = 0; i < num_keys_batch; i++) {
-                auto it = host_tree->key_to_tree_map.lower_bound(batch_keys[i]);
-                assert(it != host_tree->key_to_tree_map.end());
-                uint32_t dpu = it->second.dpu;
-                seat_id_t seat = it->second.seat;
-                /* key_index is incremented here, so batch_ctx.key_index[i][j] represents
-                * the first index for seat j in DPU i BEFORE this for loop, then
-                * the first index for seat j+1 in DPU i AFTER this for loop. */
-                int index = batch_ctx.key_index[dpu][seat]++;
-                each_request_t& req = dpu_requests[dpu].requests[index];
-                req.key = batch_keys[i];
-                req.write_val_ptr = batch_keys[i];
 #ifdef DEBUG_ON
-                verify_db.insert(std::make_pair(batch_keys[i], batch_keys[i]));
+static void check_request_pos(const BatchSlot& s)
+{
+    for (int i = 0; i < s.num_routed; i++) {
+        const request_pos_t& pos = s.request_pos[i];
+        if (pos.dpu == REQUEST_NOT_SENT)
+            assert(s.task == TASK_SUCC);
+        else
+            assert(dpu_requests[pos.dpu][pos.index].key == batch_keys[i]);
+    }
+}
 #endif /* DEBUG_ON */
-            }
-            break;
-        case TASK_SUCC:
-            for (int i = 0; i < num_keys_batch; i++) {
-                auto it = host_tree->key_to_tree_map.upper_bound(batch_keys[i]);
-                if (it != host_tree->key_to_tree_map.end()) {
-                    uint32_t dpu = it->second.dpu;
-                    seat_id_t seat = it->second.seat;
-                    /* key_index is incremented here, so batch_ctx.key_index[i][j] represents
-                    * the first index for seat j in DPU i BEFORE this for loop, then
-                    * the first index for seat j+1 in DPU i AFTER this for loop. */
-                    int index = batch_ctx.key_index[dpu][seat]++;
-                    each_request_t& req = dpu_requests[dpu].requests[index];
-                    req.key = batch_keys[i];
-                }
-            }
-            break;
-        default:
-            abort();
+
+/*
+ * Hot-key cache (-c)
+ *
+ * The keys of a batch of GET are looked up in the cache before they are
+ * routed. The value of a hit is written to get_results, and the missed keys
+ * are compacted into batch_routed_keys of the buffer, which becomes
+ * batch_keys, with their requests in request_index. A hit is routed only to
+ * count it for its seat (num_hits_for_tree), from which pack_batch estimates
+ * the send size without the cache. The cache is filled by gather_results,
+ * and is updated by the keys of a batch of INSERT before they are routed.
+ */
+#define PROBE_MISS UINT32_MAX
+#define PROBE_CHUNK_KEYS 4096
+/* seat of a hit (as an index of [NR_DPUS][NR_SEATS_IN_DPU]), or PROBE_MISS */
+static uint32_t probe_routes[NUM_REQUESTS_PER_BATCH];
+
+/* look up requests [begin, end) of a batch of GET; returns the number of misses */
+static int probe_chunk(const BatchSlot& s, const RoutingSnapshot* routing, int begin, int end)
+{
+    int misses = 0;
+    for (int i = begin; i < end; i++) {
+        key_int64_t key = batch_keys[i];
+        value_ptr_t value;
+        if (!hot_key_cache->lookup(key, &value)) {
+            probe_routes[i] = PROBE_MISS;
+            misses++;
+            continue;
+        }
+#ifdef DEBUG_ON
+        auto it = verify_db.find(key);
+        assert(value == (it == verify_db.end() ? 0 : it->second));
+#endif /* DEBUG_ON */
+        s.get_results[i].get_result = value;
+        seat_addr_t sa = routing->route(key);
+        probe_routes[i] = sa.dpu * NR_SEATS_IN_DPU + sa.seat;
+    }
+    return misses;
+}
+
+/* copy the missed requests of [begin, end) to routed_keys from dest */
+static void compact_chunk(const BatchSlot& s, key_int64_t* routed_keys, int begin, int end, int dest)
+{
+    for (int i = begin; i < end; i++)
+        if (probe_routes[i] == PROBE_MISS) {
+            routed_keys[dest] = batch_keys[i];
+            s.request_index[dest++] = i;
         }
+}
+
+static void probe_cache(BatchSlot& s, const RoutingSnapshot* routing)
+{
+    s.num_routed = s.num_keys;
+    s.request_index = NULL;
+    s.cache_hits = 0;
+    s.send_size_saved = 0;
+    if (hot_key_cache == NULL)
+        return;
+    if (s.task == TASK_INSERT) {
+        /* the value of an inserted key is the key (see fill_requests_lookup) */
+#ifdef HOST_MULTI_THREAD
+        parallel_for(0, s.num_keys, PROBE_CHUNK_KEYS, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+                hot_key_cache->update(batch_keys[i], batch_keys[i]);
+        });
+#else  /* HOST_MULTI_THREAD */
+        for (int i = 0; i < s.num_keys; i++)
+            hot_key_cache->update(batch_keys[i], batch_keys[i]);
 #endif /* HOST_MULTI_THREAD */
+        return;
+    }
+    if (s.task != TASK_GET)
+        return;
+
+    key_int64_t* routed_keys = batch_routed_keys[s.buffer];
+    s.request_index = batch_request_index[s.buffer];
+#ifdef HOST_MULTI_THREAD
+    static int chunk_dest[NUM_REQUESTS_PER_BATCH / PROBE_CHUNK_KEYS + 1];
+    int nr_chunks = (s.num_keys + PROBE_CHUNK_KEYS - 1) / PROBE_CHUNK_KEYS;
+    parallel_for(0, nr_chunks, 1, [&](int chunk, int) {
+        chunk_dest[chunk] = probe_chunk(s, routing, chunk * PROBE_CHUNK_KEYS, std::min(s.num_keys, (chunk + 1) * PROBE_CHUNK_KEYS));
+    });
+    int acc = 0;
+    for (int chunk = 0; chunk < nr_chunks; chunk++) {
+        int n = chunk_dest[chunk];
+        chunk_dest[chunk] = acc;
+        acc += n;
+    }
+    parallel_for(0, nr_chunks, 1, [&](int chunk, int) {
+        compact_chunk(s, routed_keys, chunk * PROBE_CHUNK_KEYS, std::min(s.num_keys, (chunk + 1) * PROBE_CHUNK_KEYS), chunk_dest[chunk]);
+    });
+    s.num_routed = acc;
+#else  /* HOST_MULTI_THREAD */
+    s.num_routed = probe_chunk(s, routing, 0, s.num_keys);
+    compact_chunk(s, routed_keys, 0, s.num_keys, 0);
+#endif /* HOST_MULTI_THREAD */
+    s.cache_hits = s.num_keys - s.num_routed;
+    if (s.cache_hits > 0) {
+        int* hits = &s.batch_ctx->num_hits_for_tree[0][0];
+        for (int i = 0; i < s.num_keys; i++)
+            if (probe_routes[i] != PROBE_MISS)
+                hits[probe_routes[i]]++;
+    }
+    batch_keys = routed_keys;
+}
+
+/* maximum number of requests to a DPU that the cache has saved (estimated
+ * with the placement of the subtrees after the migration) */
+static int estimate_send_size_saved(BatchCtx& batch_ctx, Migration& migration_plan)
+{
+    int sent = 0, uncached = 0;
+    for (uint32_t dpu = 0; dpu < NR_DPUS; dpu++) {
+        int n = batch_ctx.key_index[dpu][NR_SEATS_IN_DPU];
+        sent = std::max(sent, n);
+        for (seat_id_t j = 0; j < NR_SEATS_IN_DPU; j++) {
+            seat_addr_t src = migration_plan.get_source(dpu, j);
+            if (src.dpu != -1)
+                n += batch_ctx.num_hits_for_tree[src.dpu][src.seat];
+        }
+        uncached = std::max(uncached, n);
+    }
+    return uncached - sent;
+}
+
+static void count_requests(BatchSlot& s, const RoutingSnapshot* routing)
+{
+    s.epoch = routing->epoch;
+    if (opt.preprocess == Option::PREPROCESS_SORT_MERGE)
+        count_requests_sort_merge(s.task, s.num_routed, routing, *s.batch_ctx);
+    else
+        count_requests_lookup(s.task, s.num_routed, routing, *s.batch_ctx);
+}
+
+/* 0. read workload file + 1. count number of queries for each DPU, tree */
+static int read_batch(BatchSlot& s, WorkloadFile& workload, HostTree* host_tree)
+{
+    s.packed = false;
+    s.sent = false;
+    s.num_keys = prepare_batch_keys(workload, &batch_keys);
+    if (s.num_keys == 0)
+        return 0;
+
+    std::shared_ptr<const RoutingSnapshot> routing = host_tree->snapshot();
+    s.preprocess_time1 = measure_time([&] {
+        probe_cache(s, routing.get());
+        if (opt.preprocess == Option::PREPROCESS_SORT_MERGE)
+            sort_requests(s.num_routed);
+        count_requests(s, routing.get());
+    }).count();
+    return s.num_keys;
+}
+
+/* 2. migration planning + 3. migration + 4. prepare requests to send to DPUs
+ * If defer_migration, only the host tree is updated by the migration, and
+ * the subtrees are moved by issue_batch when the DPUs are idle. */
+static void pack_batch(BatchSlot& s, int num_migration, HostTree* host_tree, bool defer_migration)
+{
+    BatchCtx& batch_ctx = *s.batch_ctx;
+
+    /* the subtrees have been split or merged since the batch was counted */
+    std::shared_ptr<const RoutingSnapshot> routing = host_tree->snapshot();
+    if (routing->epoch != s.epoch) {
+        memset(batch_ctx.num_keys_for_tree, 0, sizeof(batch_ctx.num_keys_for_tree));
+        s.preprocess_time1 += measure_time([&] {
+            count_requests(s, routing.get());
+        }).count();
+    }
+
+    /* 2. migration planning */
+    s.migration_plan.reset(new Migration(host_tree));
+    Migration& migration_plan = *s.migration_plan;
+    s.migration_plan_time = measure_time([&] {
+        migration_plan.migration_plan_memory_balancing();
+        migration_plan.migration_plan_query_balancing(batch_ctx, num_migration);
+    }).count();
+
+    /* 3. execute migration according to migration_plan */
+    s.migration_time = measure_time([&] {
+        if (defer_migration)
+            migration_plan.normalize();
+        else
+            migration_plan.execute();
+        host_tree->apply_migration(&migration_plan);
+        host_tree->publish();
+    }).count();
+
+    /* 4. prepare requests to send to DPUs (with the epoch after the migration) */
+    routing = host_tree->snapshot();
+    upmem_use_buffers(s.buffer);
+    s.preprocess_time2 = measure_time([&] {
+        if (opt.preprocess == Option::PREPROCESS_SORT_MERGE)
+            fill_requests_sort_merge(s.task, s.num_routed, routing.get(), migration_plan, batch_ctx, s.request_pos);
+        else
+            fill_requests_lookup(s.task, s.num_routed, routing.get(), migration_plan, batch_ctx, s.request_pos);
 
 #ifdef PRINT_DEBUG
         print_nr_queries(&batch_ctx, &migration_plan);
@@ -625,13 +1147,85 @@ int do_one_batch(const uint64_t task, int batch_num, int migrations_per_batch, u
                 batch_ctx.send_size = batch_ctx.key_index[dpu_i][NR_SEATS_IN_DPU];
         }
 #endif /* RANK_ORIENTED_XFER */
+        if (s.cache_hits > 0)
+            s.send_size_saved = estimate_send_size_saved(batch_ctx, migration_plan);
     }).count();
+#ifdef DEBUG_ON
+    check_request_pos(s);
+#endif /* DEBUG_ON */
+    s.packed = true;
+}
+
+/* 5. query deliver (to the request slot of the batch) */
+static void send_batch(BatchSlot& s)
+{
+    upmem_use_buffers(s.buffer);
+    upmem_send_requests(s.task, *s.batch_ctx, &s.send_time);
+    s.sent = true;
+}
+
+/* (3. deferred migration) + (5. query deliver) + launch 6. DPU query execution */
+static void issue_batch(BatchSlot& s, bool defer_migration)
+{
+    if (defer_migration)
+        s.migration_time += measure_time([&] {
+            s.migration_plan->execute();
+        }).count();
+    if (!s.sent)
+        send_batch(s);
+    upmem_use_buffers(s.buffer);
+    upmem_launch(s.task);
+}
+
+#define GATHER_CHUNK_KEYS 8192  /* keys gathered by a task of the thread pool */
+
+/* 9. gather the results of the routed keys [begin, end) in the order of the
+ * requests (and fill the cache with them) */
+static void gather_results(const BatchSlot& s, int begin, int end)
+{
+#ifdef MEASURE_XFER_BYTES
+    const int node = current_node();
+    const size_t size = s.task == TASK_GET ? sizeof(each_get_result_t) : sizeof(each_succ_result_t);
+    uint64_t local = 0, remote = 0;
+    for (int i = begin; i < end; i++)
+        if (s.request_pos[i].dpu != REQUEST_NOT_SENT)
+            (numa_topology().dpu_node[s.request_pos[i].dpu] == node ? local : remote) += size;
+    numa_statistics.add(NumaStatistics::GATHER, local, remote);
+#endif /* MEASURE_XFER_BYTES */
+    if (s.task == TASK_GET && hot_key_cache != NULL) {
+        for (int i = begin; i < end; i++) {
+            const request_pos_t& pos = s.request_pos[i];
+            const each_get_result_t& r = dpu_results[pos.dpu].get[pos.index];
+            s.get_results[s.request_index[i]] = r;
+            hot_key_cache->fill(dpu_requests[pos.dpu][pos.index].key, r.get_result);
+        }
+    } else if (s.task == TASK_GET) {
+        for (int i = begin; i < end; i++) {
+            const request_pos_t& pos = s.request_pos[i];
+            s.get_results[i] = dpu_results[pos.dpu].get[pos.index];
+        }
+    } else {
+        for (int i = begin; i < end; i++) {
+            const request_pos_t& pos = s.request_pos[i];
+            if (pos.dpu == REQUEST_NOT_SENT)
+                s.succ_results[i] = each_succ_result_t{0, 0};
+            else
+                s.succ_results[i] = dpu_results[pos.dpu].succ[pos.index];
+        }
+    }
+}
+
+/* wait for 6. DPU query execution + 7. receive results + 8. merge + 9. gather results */
+static void complete_batch(BatchSlot& s, int batch_num, HostTree* host_tree)
+{
+    const uint64_t task = s.task;
+    BatchCtx& batch_ctx = *s.batch_ctx;
 
-    /* 5. query deliver + 6. DPU query execution */
-    upmem_send_task(task, batch_ctx, &send_time, &execution_time);
+    upmem_wait_task(&s.execution_time);
+    upmem_use_buffers(s.buffer);
 
     /* 7. receive results (and update CPU structs) */
-    receive_result_time = measure_time([&] {
+    s.receive_result_time = measure_time([&] {
         upmem_receive_num_kvpairs(host_tree, NULL);
         if (task == TASK_INSERT) {
             upmem_receive_split_info(NULL);
@@ -674,7 +1268,7 @@ int do_one_batch(const uint64_t task, int batch_num, int migrations_per_batch, u
 #endif /* PRINT_DISTRIBUTION */
 
     /* 8. merge small subtrees in DPU*/
-    merge_time = measure_time([&] {
+    s.merge_time = measure_time([&] {
 #ifdef MERGE
         for (uint32_t i = 0; i < NR_DPUS; i++)
             std::fill(&merge_info[i].merge_to[0], &merge_info[i].merge_to[NR_SEATS_IN_DPU], INVALID_SEAT_ID);
@@ -689,7 +1283,189 @@ int do_one_batch(const uint64_t task, int batch_num, int migrations_per_batch, u
 #endif /* MERGE */
     }).count();
 
-    return num_keys_batch;
+    /* 9. gather results in the order of the requests */
+    s.gather_time = measure_time([&] {
+        if (task != TASK_GET && task != TASK_SUCC)
+            return;
+#ifdef HOST_MULTI_THREAD
+        parallel_for(0, s.num_routed, GATHER_CHUNK_KEYS, [&](int begin, int end) {
+            gather_results(s, begin, end);
+        });
+#else  /* HOST_MULTI_THREAD */
+        gather_results(s, 0, s.num_routed);
+#endif /* HOST_MULTI_THREAD */
+    }).count();
+}
+
+int do_one_batch(const uint64_t task, int batch_num, int migrations_per_batch, uint64_t& total_num_keys, const int max_key_num, WorkloadFile& workload, HostTree* host_tree, BatchCtx& batch_ctx)
+{
+#ifdef PRINT_DEBUG
+    printf("======= batch %d =======\n", batch_num);
+#endif /* PRINT_DEBUG */
+    static BatchSlot s;
+    init_batch_slot(s, 0, task, &batch_ctx);
+
+#ifdef MEASURE_XFER_BYTES
+    xfer_statistics.new_batch();
+#endif /* MEASURE_XFER_BYTES */
+
+    /* batch 0: no migration */
+    int num_migration = batch_num == 0 ? 0 : migrations_per_batch;
+
+    if (read_batch(s, workload, host_tree) == 0)
+        return 0;
+    pack_batch(s, num_migration, host_tree, false);
+    issue_batch(s, false);
+    complete_batch(s, batch_num, host_tree);
+
+    preprocess_time1 = s.preprocess_time1;
+    preprocess_time2 = s.preprocess_time2;
+    migration_plan_time = s.migration_plan_time;
+    migration_time = s.migration_time;
+    send_time = s.send_time;
+    execution_time = s.execution_time;
+    receive_result_time = s.receive_result_time;
+    merge_time = s.merge_time;
+    gather_time = s.gather_time;
+    cache_hits = s.cache_hits;
+    send_size_saved = s.send_size_saved;
+    return s.num_keys;
+}
+
+
+/* print the statistics of a batch (in the globals; batch_time is the time
+ * to process the batch) and add them to the totals */
+static void report_batch(int batch_num, int num_keys, int send_size)
+{
+    total_preprocess_time1 += preprocess_time1;
+    total_preprocess_time2 += preprocess_time2;
+    total_migration_plan_time += migration_plan_time;
+    total_migration_time += migration_time;
+    total_send_time += send_time;
+    total_execution_time += execution_time;
+    total_receive_result_time += receive_result_time;
+    total_merge_time += merge_time;
+    total_gather_time += gather_time;
+    total_batch_time += batch_time;
+    total_cache_hits += cache_hits;
+    total_send_size_saved += send_size_saved;
+    double throughput = num_keys / batch_time;
+    /* cost of routing (counting phase) per key */
+    double route_ns_per_key = num_keys > 0 ? preprocess_time1 * 1e9 / num_keys : 0;
+#ifndef PRINT_DISTRIBUTION
+    printf("%.2f, %d, %d, %d, %d, %d, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.0f, %0.1f, %0.5f, %0.4f, %d\n",
+        opt.zipfian_const, NR_DPUS, NR_TASKLETS, batch_num,
+        num_keys, send_size, preprocess_time1, preprocess_time2, migration_plan_time, migration_time, send_time,
+        execution_time, receive_result_time, merge_time, batch_time, throughput, route_ns_per_key, gather_time,
+        num_keys > 0 ? (double)cache_hits / num_keys : 0, send_size_saved);
+#endif /* PRINT_DISTRIBUTION */
+}
+
+/*
+ * Pipelined executor (-l)
+ *
+ * Batch N+1 is read and routed while batch N is executed by the DPUs. If
+ * batch N does not change the subtrees (no insert, no merge), batch N+1 is
+ * also packed and sent to the idle request slot in MRAM, with the data
+ * movement of its migration deferred until the DPUs become idle (it does not
+ * touch the request slots). Otherwise it is packed after batch N completes,
+ * and it is routed again if the splits of batch N have published a new epoch.
+ *
+ * execution_time of a batch is the time from its launch to its completion,
+ * and batch_time is the interval between the completions of consecutive
+ * batches, so the total batch_time is the elapsed time.
+ */
+static float pipeline_wall_time;
+
+static uint64_t run_pipeline(uint64_t task, WorkloadFile& workload, HostTree* host_tree)
+{
+    static BatchCtx batch_ctx[2];
+    static BatchSlot slots[2];
+    bool can_pack_early = task != TASK_INSERT;
+#ifdef MERGE
+    can_pack_early = false;
+#endif /* MERGE */
+    uint64_t total_num_keys = 0;
+    struct timeval start, last, now;
+
+    for (int i = 0; i < 2; i++)
+        init_batch_slot(slots[i], i, task, &batch_ctx[i]);
+
+    gettimeofday(&start, NULL);
+    last = start;
+    BatchSlot* cur = &slots[0];
+    if (read_batch(*cur, workload, host_tree) == 0)
+        return 0;
+#ifdef MEASURE_XFER_BYTES
+    xfer_statistics.new_batch();
+#endif /* MEASURE_XFER_BYTES */
+    pack_batch(*cur, 0 /* batch 0: no migration */, host_tree, true);
+    issue_batch(*cur, true);
+
+    for (int batch_num = 0;; batch_num++) {
+        /* next batch, while the DPUs execute the current batch */
+        BatchSlot* next = &slots[(batch_num + 1) % 2];
+        *next->batch_ctx = BatchCtx();
+        int n = 0;
+        if (total_num_keys + cur->num_keys < (uint64_t)opt.nr_total_queries)
+            n = read_batch(*next, workload, host_tree);
+        if (n > 0 && can_pack_early) {
+            pack_batch(*next, opt.nr_migrations_per_batch, host_tree, true);
+            send_batch(*next);
+        }
+
+        complete_batch(*cur, batch_num, host_tree);
+        total_num_keys += cur->num_keys;
+        gettimeofday(&now, NULL);
+        preprocess_time1 = cur->preprocess_time1;
+        preprocess_time2 = cur->preprocess_time2;
+        migration_plan_time = cur->migration_plan_time;
+        migration_time = cur->migration_time;
+        send_time = cur->send_time;
+        execution_time = cur->execution_time;
+        receive_result_time = cur->receive_result_time;
+        merge_time = cur->merge_time;
+        gather_time = cur->gather_time;
+        cache_hits = cur->cache_hits;
+        send_size_saved = cur->send_size_saved;
+        batch_time = time_diff(&last, &now);
+        last = now;
+        report_batch(batch_num + 1, cur->num_keys, cur->batch_ctx->send_size);
+
+        if (n == 0)
+            break;
+#ifdef MEASURE_XFER_BYTES
+        xfer_statistics.new_batch();
+#endif /* MEASURE_XFER_BYTES */
+        if (!next->packed)
+            pack_batch(*next, opt.nr_migrations_per_batch, host_tree, true);
+        issue_batch(*next, true);
+        cur = next;
+    }
+    pipeline_wall_time = time_diff(&start, &last);
+    return total_num_keys;
+}
+
+/* share of the elapsed time each stage is busy */
+static void print_pipeline_occupancy()
+{
+    struct {
+        const char* name;
+        float time;
+    } stages[] = {
+        {"route", total_preprocess_time1},
+        {"plan", total_migration_plan_time},
+        {"migrate", total_migration_time},
+        {"pack", total_preprocess_time2},
+        {"send", total_send_time},
+        {"dpu", total_execution_time},
+        {"receive", total_receive_result_time},
+        {"merge", total_merge_time},
+        {"gather", total_gather_time},
+    };
+    printf("stage, busy_time, occupancy\n");
+    for (auto& st : stages)
+        printf("%s, %0.5f, %0.3f\n", st.name, st.time, pipeline_wall_time > 0 ? st.time / pipeline_wall_time : 0);
 }
 
 int main(int argc, char* argv[])
@@ -698,7 +1474,6 @@ int main(int argc, char* argv[])
 
     /* In current implementation, bitmap word is 64 bit. So NR_SEAT_IN_DPU must not be greater than 64. */
     assert(NR_SEATS_IN_DPU <= 64);
-    assert(sizeof(dpu_requests_t) == sizeof(dpu_requests[0]));
 #ifdef PRINT_DEBUG
     std::cout << "NR_DPUS:" << NR_DPUS << std::endl
               << "NR_TASKLETS:" << NR_TASKLETS << std::endl
@@ -714,13 +1489,18 @@ int main(int argc, char* argv[])
               
 #endif
 
-    upmem_init(opt.dpu_binary, opt.is_simulator);
+    upmem_init(opt.dpu_binary, opt.is_simulator, opt.pipeline ? 2 : 1);
+    if (opt.print_topology)
+        numa_topology().print(stdout);
 
-    int keys_array_size = NUM_INIT_REQS > NUM_REQUESTS_PER_BATCH ? NUM_INIT_REQS : NUM_REQUESTS_PER_BATCH;
-    batch_keys = (key_int64_t*)malloc(keys_array_size * sizeof(key_int64_t));
+    sorted_keys = (key_int64_t*)malloc(NUM_REQUESTS_PER_BATCH * sizeof(key_int64_t));
+    sort_scratch = (key_int64_t*)malloc(NUM_REQUESTS_PER_BATCH * sizeof(key_int64_t));
+    if (opt.cache_entries > 0)
+        hot_key_cache = new HotKeyCache(opt.cache_entries);
 
     /* initialization */
     HostTree* host_tree = new HostTree(NR_INITIAL_TREES_IN_DPU);
+    host_tree->set_router(opt.router);
     int num_init_reqs = NUM_INIT_REQS;
     initialize_dpus(num_init_reqs, host_tree);
 #ifdef PRINT_DEBUG
@@ -728,8 +1508,8 @@ int main(int argc, char* argv[])
 #endif
 
     /* load workload file */
-    std::ifstream file_input(opt.workload_file, std::ios_base::binary);
-    if (!file_input) {
+    WorkloadFile workload;
+    if (!workload.open(opt.workload_file)) {
         printf("cannot open file\n");
         return 1;
     }
@@ -742,42 +1522,31 @@ int main(int argc, char* argv[])
     printf("batch, DPU, nqueries, nkvpairs, nnodes\n");
 #endif /* PRINT_DISTRIBUTION */
 #ifndef PRINT_DISTRIBUTION
-    printf("zipfian_const, NR_DPUS, NR_TASKLETS, batch_num, num_keys, max_query_num, preprocess_time1, preprocess_time2, migration_plan_time, migration_time, send_time, execution_time, receive_result_time, merge_time, batch_time, throughput\n");
+    printf("zipfian_const, NR_DPUS, NR_TASKLETS, batch_num, num_keys, max_query_num, preprocess_time1, preprocess_time2, migration_plan_time, migration_time, send_time, execution_time, receive_result_time, merge_time, batch_time, throughput, route_ns_per_key, gather_time, cache_hit_rate, send_size_saved\n");
 #endif /* PRINT_DISTRIBUTION */
-    while (total_num_keys < opt.nr_total_queries) {
+    uint64_t task;
+    switch (opt.op_type) {
+    case Option::OP_TYPE_GET:
+        task = TASK_GET;
+        break;
+    case Option::OP_TYPE_INSERT:
+        task = TASK_INSERT;
+        break;
+    case Option::OP_TYPE_SUCC:
+        task = TASK_SUCC;
+        break;
+    default:
+        abort();
+    }
+    if (opt.pipeline)
+        total_num_keys = run_pipeline(task, workload, host_tree);
+    while (!opt.pipeline && total_num_keys < opt.nr_total_queries) {
         BatchCtx batch_ctx;
-        switch (opt.op_type) {
-        case Option::OP_TYPE_GET:
-            num_keys = do_one_batch(TASK_GET, batch_num, opt.nr_migrations_per_batch, total_num_keys, opt.nr_total_queries, file_input, host_tree, batch_ctx);
-            break;
-        case Option::OP_TYPE_INSERT:
-            num_keys = do_one_batch(TASK_INSERT, batch_num, opt.nr_migrations_per_batch, total_num_keys, opt.nr_total_queries, file_input, host_tree, batch_ctx);
-            break;
-        case Option::OP_TYPE_SUCC:
-            num_keys = do_one_batch(TASK_SUCC, batch_num, opt.nr_migrations_per_batch, total_num_keys, opt.nr_total_queries, file_input, host_tree, batch_ctx);
-            break;
-        default:
-            abort();
-        }
+        num_keys = do_one_batch(task, batch_num, opt.nr_migrations_per_batch, total_num_keys, opt.nr_total_queries, workload, host_tree, batch_ctx);
         total_num_keys += num_keys;
         batch_num++;
-        batch_time = preprocess_time1 + preprocess_time2 + migration_plan_time + migration_time + send_time + execution_time + receive_result_time + merge_time;
-        total_preprocess_time1 += preprocess_time1;
-        total_preprocess_time2 += preprocess_time2;
-        total_migration_plan_time += migration_plan_time;
-        total_migration_time += migration_time;
-        total_send_time += send_time;
-        total_execution_time += execution_time;
-        total_receive_result_time += receive_result_time;
-        total_merge_time += merge_time;
-        total_batch_time += batch_time;
-        double throughput = num_keys / batch_time;
-#ifndef PRINT_DISTRIBUTION
-        printf("%.2f, %d, %d, %d, %d, %d, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.0f\n",
-            opt.zipfian_const, NR_DPUS, NR_TASKLETS, batch_num,
-            num_keys, batch_ctx.send_size, preprocess_time1, preprocess_time2, migration_plan_time, migration_time, send_time,
-            execution_time, receive_result_time, merge_time, batch_time, throughput);
-#endif /* PRINT_DISTRIBUTION */
+        batch_time = preprocess_time1 + preprocess_time2 + migration_plan_time + migration_time + send_time + execution_time + receive_result_time + merge_time + gather_time;
+        report_batch(batch_num, num_keys, batch_ctx.send_size);
     }
 
 
@@ -788,20 +1557,27 @@ int main(int argc, char* argv[])
     //printf("%s, %d, %d, %d, %d, %ld, %ld, %ld, %ld, %0.5f, %0.5f, %0.5f, %0.3f, %0.5f, %0.0f\n", zipfian_const.c_str(), NR_DPUS, NR_TASKLETS, NUM_BPTREE_IN_CPU, NUM_BPTREE_IN_DPU * NR_DPUS, (long int)2 * total_num_keys, 2 * total_num_keys_cpu, 2 * total_num_keys_dpu, 100 * total_num_keys_cpu / total_num_keys, send_time, cpu_time,
     //    execution_time, 100 * cpu_time / execution_time, send_and_execution_time, total_time, throughput);
     double throughput = total_num_keys / total_batch_time;
+    double route_ns_per_key = total_num_keys > 0 ? total_preprocess_time1 * 1e9 / total_num_keys : 0;
 
 #ifndef PRINT_DISTRIBUTION
-    printf("%.2f, %d, %d, total, %ld,, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f\n",
+    printf("%.2f, %d, %d, total, %ld,, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.5f, %0.1f, %0.5f, %0.4f, %lu\n",
         opt.zipfian_const, NR_DPUS, NR_TASKLETS,
         total_num_keys, total_preprocess_time1, total_preprocess_time2, total_migration_plan_time, total_migration_time, total_send_time,
-        total_execution_time, total_receive_result_time, total_merge_time, total_batch_time, throughput);
+        total_execution_time, total_receive_result_time, total_merge_time, total_batch_time, throughput, route_ns_per_key, total_gather_time,
+        total_num_keys > 0 ? (double)total_cache_hits / total_num_keys : 0, total_send_size_saved);
 #endif /* PRINT_DISTRIBUTION */
 
 #ifdef MEASURE_XFER_BYTES
     xfer_statistics.print(stdout);
+    numa_statistics.print(stdout);
 #endif /* MEASURE_XFER_BYTES */
 
+    if (opt.pipeline)
+        print_pipeline_occupancy();
+
     upmem_release();
     delete host_tree;
+    delete hot_key_cache;
     return 0;
 }
 
@@ -814,7 +1590,28 @@ void HostTree::apply_migration(Migration* m)
         inv_map_del(from);
         inv_map_add(to, key);
         key_to_tree_map[key] = to;
+        writable_snapshot().update(key, to);
+    }
+}
+
+void HostTree::apply_split(seat_addr_t old_sa, const split_info_t& split)
+{
+    static key_int64_t ubs[MAX_NUM_SPLIT];
+    static seat_addr_t seats[MAX_NUM_SPLIT];
+    key_int64_t old_ub = inverse(old_sa);
+    key_to_tree_map.erase(old_ub);
+    inv_map_del(old_sa);  // TODO: insearted this line. correct?
+    for (int new_tree = 0; new_tree < split.num_split; new_tree++) {
+        seat_id_t new_seat_id = split.new_tree_index[new_tree];
+        // printf("split: DPU %d seat %d -> seat %d\n", old_sa.dpu, old_sa.seat, new_seat_id);
+        key_int64_t ub = split.split_key[new_tree]; if (ub > old_ub) fprintf(stderr, "OUT OF RANGE %lu > %lu\n", ub, old_ub);
+        seat_addr_t new_sa = seat_addr_t(old_sa.dpu, new_seat_id);
+        key_to_tree_map[ub] = new_sa;
+        inv_map_add(new_sa, ub);
+        ubs[new_tree] = ub;
+        seats[new_tree] = new_sa;
     }
+    writable_snapshot().split(old_ub, ubs, seats, split.num_split);
 }
 
 //
@@ -2,6 +2,7 @@
 #include "common.h"
 #include "host_data_structures.hpp"
 #include "node_defs.hpp"
+#include "thread_pool.hpp"
 #include "upmem.hpp"
 #include <algorithm>
 #include <cassert>
@@ -132,13 +133,20 @@ void Migration::migration_plan_query_balancing(BatchCtx& batch_ctx, int num_migr
 
     for (uint32_t i = 0; i < NR_DPUS; i++)
         dpu_ids[i] = i;
-    for (uint32_t i = 0; i < NR_DPUS; i++) {
-        int nkeys = 0;
-        for (int j = 0; j < NR_SEATS_IN_DPU; j++) {
-            nkeys += get_num_queries_for_source(batch_ctx, i, j);
+    auto count_keys = [&](uint32_t dpu_begin, uint32_t dpu_end) {
+        for (uint32_t i = dpu_begin; i < dpu_end; i++) {
+            int nkeys = 0;
+            for (int j = 0; j < NR_SEATS_IN_DPU; j++) {
+                nkeys += get_num_queries_for_source(batch_ctx, i, j);
+            }
+            nr_keys_for_dpu[i] = nkeys;
         }
-        nr_keys_for_dpu[i] = nkeys;
-    }
+    };
+#ifdef HOST_MULTI_THREAD
+    parallel_for(0, NR_DPUS, 64, count_keys);
+#else  /* HOST_MULTI_THREAD */
+    count_keys(0, NR_DPUS);
+#endif /* HOST_MULTI_THREAD */
     /* sort `dpu_ids` from many queries to few queries */
     std::sort(dpu_ids, dpu_ids + NR_DPUS, [&](uint32_t a, uint32_t b) {
         return nr_keys_for_dpu[a] > nr_keys_for_dpu[b];
@@ -1,11 +1,15 @@
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <assert.h>
+#include <algorithm>
 #include "common.h"
 #include "host_data_structures.hpp"
 #include "node_defs.hpp"
+#include "numa_topology.hpp"
 #include "utils.hpp"
 #include "statistics.hpp"
+#include "upmem.hpp"
 
 #ifdef PRINT_DEBUG
 #include <cstdio>
@@ -23,17 +27,58 @@ extern "C" {
 #include <dpu.h>
 #include <dpu_log.h>
 }
+static bool dpus_running;
 #endif /* HOST_ONLY */
 
 static dpu_set_t dpu_set;
 
-/* buffer */
-dpu_requests_t* dpu_requests;
-dpu_results_t* dpu_results;
-merge_info_t merge_info[NR_DPUS];
-split_info_t split_result[NR_DPUS][NR_SEATS_IN_DPU];
-dpu_init_param_t dpu_init_param[NR_DPUS][NR_SEATS_IN_DPU];
-static BPTreeNode tree_migration_buffer[MAX_NUM_NODES_IN_SEAT];
+/*
+ * Host buffers
+ *
+ * The requests to and the results from the DPUs of a rank are in the arenas
+ * of the rank, laid out for each batch by upmem_layout_buffers. Every DPU of
+ * a rank has the same number of entries (the maximum number of requests to
+ * a DPU of the rank, or to any DPU without RANK_ORIENTED_XFER), as a
+ * transfer to a set of DPUs has the same size for every DPU. An arena grows
+ * when a batch needs more than its capacity and is reused by later batches,
+ * so the memory used follows the size of the batches, not the capacity of
+ * MRAM. The arenas of a rank are placed on the NUMA node of the rank.
+ */
+struct XferBuffer {
+    char* addr;
+    size_t length;  /* of the mapping (rounded up to the page size) */
+};
+
+struct RankArena {
+    XferBuffer requests;
+    XferBuffer results;
+    size_t capacity;  /* in entries of each arena */
+};
+
+struct HostBuffer {
+    RankArena arenas[NUMA_MAX_RANKS];
+    each_request_t* requests[NR_DPUS];
+    dpu_results_ref_t results[NR_DPUS];
+};
+
+/* entry of the results arena (large enough for any result) */
+#define RESULT_ENTRY_SIZE \
+    (sizeof(each_get_result_t) > sizeof(each_succ_result_t) ? sizeof(each_get_result_t) : sizeof(each_succ_result_t))
+
+each_request_t** dpu_requests;
+dpu_results_ref_t* dpu_results;
+/* dpu_requests and dpu_results point to one of them (upmem_use_buffers) */
+static HostBuffer host_buffers[NR_HOST_BUFFERS];
+static HostBuffer* current_buffer;
+/* request slot in MRAM used with dpu_requests and dpu_results */
+static size_t current_slot;
+/* time of the last launch; for upmem_wait_task */
+static struct timeval launch_time;
+/* allocated by upmem_init as transfer buffers */
+merge_info_t* merge_info;
+split_info_t (*split_result)[NR_SEATS_IN_DPU];
+dpu_init_param_t (*dpu_init_param)[NR_SEATS_IN_DPU];
+static BPTreeNode* tree_migration_buffer;
 #ifdef PRINT_DISTRIBUTION
     int numofnodes[NR_DPUS][NR_SEATS_IN_DPU];
 #endif
@@ -78,7 +123,7 @@ select_dpu(dpu_set_t* dst, uint32_t index)
 }
 
 static void
-xfer_foreach(dpu_set_t set, const char* symbol, size_t size,
+xfer_foreach(dpu_set_t set, const char* symbol, size_t offset, size_t size,
                 const void* array, size_t elmsize, bool to_dpu)
 {
     uintptr_t addr = (uintptr_t) array;
@@ -88,7 +133,7 @@ xfer_foreach(dpu_set_t set, const char* symbol, size_t size,
         uint64_t max_xfer_bytes = 0;
         for (int j = 0; i < EMU_MAX_DPUS && j < EMU_DPUS_IN_RANK; i++, j++) {
             if (set[i]) {
-                void* mram_addr = emu[i].get_addr_of_symbol(symbol);
+                char* mram_addr = (char*) emu[i].get_addr_of_symbol(symbol) + offset;
                 if (to_dpu)
                     memcpy(mram_addr, (void*) addr, size);
                 else
@@ -106,13 +151,40 @@ xfer_foreach(dpu_set_t set, const char* symbol, size_t size,
 #endif /* MEASURE_XFER_BYTES */
 }
 
+/* version with a buffer for each DPU */
+static void
+xfer_foreach_ptr(dpu_set_t set, const char* symbol, size_t offset, size_t size,
+                 void* const* ptrs, bool to_dpu)
+{
+    uint64_t total_xfer_bytes = 0;
+    uint64_t total_effective_bytes = 0;
+    for (int i = 0; i < EMU_MAX_DPUS;) {
+        uint64_t max_xfer_bytes = 0;
+        for (int j = 0; i < EMU_MAX_DPUS && j < EMU_DPUS_IN_RANK; i++, j++) {
+            if (set[i]) {
+                char* mram_addr = (char*) emu[i].get_addr_of_symbol(symbol) + offset;
+                if (to_dpu)
+                    memcpy(mram_addr, ptrs[i], size);
+                else
+                    memcpy(ptrs[i], mram_addr, size);
+                total_effective_bytes += size;
+                if (size > max_xfer_bytes)
+                    max_xfer_bytes = size;
+            }
+        }
+        total_xfer_bytes += max_xfer_bytes * EMU_DPUS_IN_RANK;
+    }
+#ifdef MEASURE_XFER_BYTES
+    xfer_statistics.add(symbol, total_xfer_bytes, total_effective_bytes);
+#endif /* MEASURE_XFER_BYTES */
+}
+
 #ifdef RANK_ORIENTED_XFER
 /* variable-length array version */
 static void
-xfer_foreach_va(dpu_set_t set, const char* symbol, const void* array,
-                size_t interval, size_t* xfer_bytes, bool to_dpu)
+xfer_foreach_va(dpu_set_t set, const char* symbol, size_t offset, void* const* ptrs,
+                size_t* xfer_bytes, bool to_dpu)
 {
-    uintptr_t addr = (uintptr_t) array;
     uint64_t total_xfer_bytes = 0;
     uint64_t total_effective_bytes = 0;
     for (int i = 0; i < EMU_MAX_DPUS; i += EMU_DPUS_IN_RANK) {
@@ -127,12 +199,11 @@ xfer_foreach_va(dpu_set_t set, const char* symbol, const void* array,
             }
         for (int j = 0; i + j < EMU_MAX_DPUS && j < EMU_DPUS_IN_RANK; j++)
             if (set[i + j]) {
-                void* mram_addr = emu[i + j].get_addr_of_symbol(symbol);
+                char* mram_addr = (char*) emu[i + j].get_addr_of_symbol(symbol) + offset;
                 if (to_dpu)
-                    memcpy(mram_addr, (void*) addr, max_xfer_bytes);
+                    memcpy(mram_addr, ptrs[i + j], max_xfer_bytes);
                 else
-                    memcpy((void*) addr, mram_addr, max_xfer_bytes);
-                addr += interval;
+                    memcpy(ptrs[i + j], mram_addr, max_xfer_bytes);
             }
         total_xfer_bytes += max_xfer_bytes * EMU_DPUS_IN_RANK;
     }
@@ -165,14 +236,26 @@ broadcast(dpu_set_t set, const char* symbol, const void* addr, size_t size)
 }
 
 static void
-execute(dpu_set_t set)
+execute_async(dpu_set_t set)
 {
     for (int i = 0; i < EMU_MAX_DPUS; i++)
         if (set[i])
             emu[i].execute();
+}
+
+static void
+wait_dpus(dpu_set_t set)
+{
     Emulation::wait_all();
 }
 
+static void
+execute(dpu_set_t set)
+{
+    execute_async(set);
+    wait_dpus(set);
+}
+
 #else /* HOST_ONLY */
 static uint32_t
 nr_dpus_in_set(dpu_set_t set)
@@ -192,8 +275,15 @@ select_dpu(dpu_set_t* dst, uint32_t index)
     abort();
 }
 
+/* transfers to/from DPUs that are running are queued after the execution */
+static dpu_xfer_flags_t
+xfer_flags()
+{
+    return dpus_running ? DPU_XFER_ASYNC : DPU_XFER_DEFAULT;
+}
+
 static void
-xfer_foreach(dpu_set_t set, const char* symbol, size_t size,
+xfer_foreach(dpu_set_t set, const char* symbol, size_t offset, size_t size,
                 const void* array, size_t elmsize, bool to_dpu)
 {
     dpu_set_t dpu;
@@ -205,16 +295,30 @@ xfer_foreach(dpu_set_t set, const char* symbol, size_t size,
         addr += elmsize;
     }
     DPU_ASSERT(dpu_push_xfer(
-        dpu_set, dir, symbol, 0, size, DPU_XFER_DEFAULT));
+        dpu_set, dir, symbol, offset, size, xfer_flags()));
 }
 
+/* version with a buffer for each DPU */
 static void
-xfer_foreach_va(dpu_set_t set, const char* symbol, const void* array,
-               size_t interval, size_t* xfer_bytes, bool to_dpu)
+xfer_foreach_ptr(dpu_set_t set, const char* symbol, size_t offset, size_t size,
+                 void* const* ptrs, bool to_dpu)
+{
+    dpu_set_t dpu;
+    uint32_t each_dpu;
+    dpu_xfer_t dir = to_dpu ? DPU_XFER_TO_DPU : DPU_XFER_FROM_DPU;
+
+    DPU_FOREACH(dpu_set, dpu, each_dpu)
+        DPU_ASSERT(dpu_prepare_xfer(dpu, ptrs[each_dpu]));
+    DPU_ASSERT(dpu_push_xfer(
+        dpu_set, dir, symbol, offset, size, xfer_flags()));
+}
+
+static void
+xfer_foreach_va(dpu_set_t set, const char* symbol, size_t offset, void* const* ptrs,
+               size_t* xfer_bytes, bool to_dpu)
 {
     dpu_set_t rank, dpu;
     dpu_xfer_t dir = to_dpu ? DPU_XFER_TO_DPU : DPU_XFER_FROM_DPU;
-    uintptr_t addr = (uintptr_t) array;
 
     /* 
      * We assume DPU_RANK_FOREACH & DPU_FOREACH yields the dpus in the
@@ -224,17 +328,17 @@ xfer_foreach_va(dpu_set_t set, const char* symbol, const void* array,
     DPU_RANK_FOREACH(dpu_set, rank) {
         size_t max_xfer_bytes = 0;
         DPU_FOREACH(rank, dpu) {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, (void*) addr));
-            addr += interval;
+            DPU_ASSERT(dpu_prepare_xfer(dpu, ptrs[dpu_index]));
             size_t b = xfer_bytes[dpu_index];
             if (b > max_xfer_bytes)
                 max_xfer_bytes = b;
             dpu_index++;
         }
         DPU_ASSERT(dpu_push_xfer(
-            rank, dir, symbol, 0, max_xfer_bytes, DPU_XFER_ASYNC));
+            rank, dir, symbol, offset, max_xfer_bytes, DPU_XFER_ASYNC));
     }
-    DPU_ASSERT(dpu_sync(dpu_set));
+    if (!dpus_running)
+        DPU_ASSERT(dpu_sync(dpu_set));
 }
 
 static void
@@ -244,6 +348,20 @@ broadcast(dpu_set_t set, const char* symbol, const void* addr, size_t size)
         dpu_set, symbol, 0, addr, size, DPU_XFER_DEFAULT));
 }
 
+static void
+execute_async(dpu_set_t set)
+{
+    DPU_ASSERT(dpu_launch(set, DPU_ASYNCHRONOUS));
+    dpus_running = true;
+}
+
+static void
+wait_dpus(dpu_set_t set)
+{
+    DPU_ASSERT(dpu_sync(set));
+    dpus_running = false;
+}
+
 static void
 execute(dpu_set_t dpu_set)
 {
@@ -264,17 +382,26 @@ xfer_single(dpu_set_t set, const char* symbol, size_t size,
                 const void* addr, bool to_dpu)
 {
     assert(nr_dpus_in_set(set) == 1);
-    xfer_foreach(set, symbol, size, addr, 0, to_dpu);
+    xfer_foreach(set, symbol, 0, size, addr, 0, to_dpu);
 }
 
 #define SEND_FOREACH(set,sym,size,ary) \
-    xfer_foreach(set, sym, size, ary, sizeof((ary)[0]), true)
-#define SEND_FOREACH_VA(set,sym,ary,sizes) \
-    xfer_foreach_va(set, sym, ary, sizeof((ary)[0]), sizes, true)
+    xfer_foreach(set, sym, 0, size, ary, sizeof((ary)[0]), true)
 #define RECV_FOREACH(set,sym,size,ary) \
-    xfer_foreach(set, sym, size, ary, sizeof((ary)[0]), false)
-#define RECV_FOREACH_VA(set,sym,ary,sizes) \
-    xfer_foreach_va(set, sym, ary, sizeof((ary)[0]), sizes, false)
+    xfer_foreach(set, sym, 0, size, ary, sizeof((ary)[0]), false)
+/* to/from the element of the current request slot of a symbol of
+ * [NR_REQUEST_SLOTS][...] (slot_size: size of an element) */
+#define SEND_FOREACH_SLOT(set,sym,slot_size,size,ary) \
+    xfer_foreach(set, sym, current_slot * (slot_size), size, ary, sizeof((ary)[0]), true)
+/* ptrs: buffer for each DPU */
+#define SEND_FOREACH_PTR_SLOT(set,sym,slot_size,size,ptrs) \
+    xfer_foreach_ptr(set, sym, current_slot * (slot_size), size, (void* const*)(ptrs), true)
+#define SEND_FOREACH_VA_SLOT(set,sym,slot_size,ptrs,sizes) \
+    xfer_foreach_va(set, sym, current_slot * (slot_size), (void* const*)(ptrs), sizes, true)
+#define RECV_FOREACH_PTR_SLOT(set,sym,slot_size,size,ptrs) \
+    xfer_foreach_ptr(set, sym, current_slot * (slot_size), size, (void* const*)(ptrs), false)
+#define RECV_FOREACH_VA_SLOT(set,sym,slot_size,ptrs,sizes) \
+    xfer_foreach_va(set, sym, current_slot * (slot_size), (void* const*)(ptrs), sizes, false)
 #define SEND_SINGLE(set,sym,size,addr) \
     xfer_single(set, sym, size, addr, true)
 #define RECV_SINGLE(set,sym,size,addr) \
@@ -284,12 +411,123 @@ xfer_single(dpu_set_t set, const char* symbol, size_t size,
 //  UPMEM module interface
 //
 
-void upmem_init(const char* binary, bool is_simulator)
+/* NUMA node of each rank */
+static void find_rank_nodes()
+{
+    NumaTopology& topo = numa_topology();
+#ifdef HOST_ONLY
+    /* emulated ranks are divided evenly into the nodes */
+    int nr_ranks = (NR_DPUS + EMU_DPUS_IN_RANK - 1) / EMU_DPUS_IN_RANK;
+    for (int r = 0; r < nr_ranks; r++)
+        topo.add_rank(std::min((r + 1) * EMU_DPUS_IN_RANK, NR_DPUS), r * topo.nr_nodes / nr_ranks);
+#else  /* HOST_ONLY */
+    /* ranks are assumed to be allocated in the order of the devices */
+    dpu_set_t rank, dpu;
+    uint32_t each_rank;
+    uint32_t nr_dpus = 0;
+    DPU_RANK_FOREACH(dpu_set, rank, each_rank) {
+        DPU_FOREACH(rank, dpu)
+            nr_dpus++;
+        topo.add_rank(nr_dpus, NumaTopology::read_rank_node(each_rank));
+    }
+#endif /* HOST_ONLY */
+}
+
+/*
+ * Transfer buffers
+ *
+ * Host memory transferred to and from the DPUs is mapped with huge pages if
+ * possible (XFER_HUGE_PAGES): 1 GB pages for a buffer of 1 GB or more, and
+ * 2 MB pages for a buffer of 2 MB or more. A transfer touches the whole
+ * buffer of every DPU, so it causes far fewer TLB misses than with 4 KB
+ * pages. If no huge page of the size is reserved (vm.nr_hugepages), the
+ * buffer is mapped with normal pages and advised to be backed by transparent
+ * huge pages. The buffer is locked in memory if the limit permits.
+ */
+#ifndef XFER_HUGE_PAGES
+#define XFER_HUGE_PAGES 1
+#endif /* XFER_HUGE_PAGES */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#define HUGE_PAGE_2MB (1UL << 21)
+#define HUGE_PAGE_1GB (1UL << 30)
+
+/* memory for a transfer buffer named name on node (-1: any node) */
+static void alloc_xfer_buffer(XferBuffer& buf, size_t size, int node, const char* name)
+{
+    void* p = MAP_FAILED;
+    const char* pages = "4K";
+#if XFER_HUGE_PAGES
+    if (size >= HUGE_PAGE_1GB) {
+        buf.length = (size + HUGE_PAGE_1GB - 1) & ~(HUGE_PAGE_1GB - 1);
+        p = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+        pages = "1G";
+    }
+    if (p == MAP_FAILED && size >= HUGE_PAGE_2MB) {
+        buf.length = (size + HUGE_PAGE_2MB - 1) & ~(HUGE_PAGE_2MB - 1);
+        p = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        pages = "2M";
+    }
+#endif /* XFER_HUGE_PAGES */
+    if (p == MAP_FAILED) {
+        buf.length = size;
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        pages = "4K";
+        if (p == MAP_FAILED) {
+            printf("[ERROR] cannot allocate %lu bytes for %s\n", size, name);
+            exit(1);
+        }
+#if XFER_HUGE_PAGES
+        if (size >= HUGE_PAGE_2MB && madvise(p, size, MADV_HUGEPAGE) == 0)
+            pages = "THP";
+#endif /* XFER_HUGE_PAGES */
+    }
+    if (node >= 0)
+        numa_topology().bind_memory(p, buf.length, node);
+    mlock(p, buf.length);
+    buf.addr = (char*)p;
+#ifdef MEASURE_XFER_BYTES
+    xfer_statistics.add_buffer(name, pages, buf.length);
+#endif /* MEASURE_XFER_BYTES */
+}
+
+static void free_xfer_buffer(XferBuffer& buf)
+{
+    munmap(buf.addr, buf.length);
+    buf.addr = NULL;
+    buf.length = 0;
+}
+
+/* make the arenas of rank r hold at least entries entries */
+static void reserve_arena(RankArena& a, int r, size_t entries)
+{
+    if (entries <= a.capacity)
+        return;
+    const NumaTopology& topo = numa_topology();
+    size_t capacity = std::max(entries, a.capacity * 2);
+    if (a.capacity > 0) {
+        free_xfer_buffer(a.requests);
+        free_xfer_buffer(a.results);
+    }
+    alloc_xfer_buffer(a.requests, capacity * sizeof(each_request_t), topo.rank_node[r], "dpu_requests");
+    alloc_xfer_buffer(a.results, capacity * RESULT_ENTRY_SIZE, topo.rank_node[r], "dpu_results");
+    a.capacity = capacity;
+}
+
+void upmem_init(const char* binary, bool is_simulator, int nr_buffers)
 {
     int nr_dpus_allocated;
 
-    dpu_requests = (dpu_requests_t*)malloc((NR_DPUS) * sizeof(dpu_requests_t));
-    dpu_results = (dpu_results_t*)malloc((NR_DPUS) * sizeof(dpu_results_t));
+    assert(0 < nr_buffers && nr_buffers <= NR_HOST_BUFFERS);
 
 #ifdef HOST_ONLY
     for (int i = 0; i < NR_DPUS; i++) {
@@ -305,6 +543,21 @@ void upmem_init(const char* binary, bool is_simulator)
     DPU_ASSERT(dpu_load(dpu_set, binary, NULL));
 #endif /* HOST_ONLY */
 
+    /* host buffers are allocated by upmem_layout_buffers */
+    find_rank_nodes();
+    upmem_use_buffers(0);
+
+    /* buffers of the metadata and the migration */
+    XferBuffer buf;
+    alloc_xfer_buffer(buf, sizeof(merge_info_t) * NR_DPUS, -1, "merge_info");
+    merge_info = (merge_info_t*)buf.addr;
+    alloc_xfer_buffer(buf, sizeof(split_info_t) * NR_SEATS_IN_DPU * NR_DPUS, -1, "split_result");
+    split_result = (split_info_t(*)[NR_SEATS_IN_DPU])buf.addr;
+    alloc_xfer_buffer(buf, sizeof(dpu_init_param_t) * NR_SEATS_IN_DPU * NR_DPUS, -1, "dpu_init_param");
+    dpu_init_param = (dpu_init_param_t(*)[NR_SEATS_IN_DPU])buf.addr;
+    alloc_xfer_buffer(buf, sizeof(BPTreeNode) * MAX_NUM_NODES_IN_SEAT, -1, "tree_migration_buffer");
+    tree_migration_buffer = (BPTreeNode*)buf.addr;
+
 #ifdef PRINT_DEBUG
     printf("Allocated %d DPU(s)\n", upmem_get_nr_dpus());
 #endif /* PRINT_DEBUG */
@@ -325,8 +578,56 @@ uint32_t upmem_get_nr_dpus()
     return nr_dpus_in_set(dpu_set);
 }
 
+void upmem_use_buffers(int buffer)
+{
+    current_buffer = &host_buffers[buffer];
+    dpu_requests = current_buffer->requests;
+    dpu_results = current_buffer->results;
+    current_slot = buffer;
+}
+
+void upmem_layout_buffers(BatchCtx& batch_ctx)
+{
+    const NumaTopology& topo = numa_topology();
+    HostBuffer& buf = *current_buffer;
+#ifndef RANK_ORIENTED_XFER
+    int max_reqs = 0;
+    for (uint32_t dpu = 0; dpu < NR_DPUS; dpu++)
+        max_reqs = std::max(max_reqs, batch_ctx.key_index[dpu][NR_SEATS_IN_DPU]);
+#endif /* RANK_ORIENTED_XFER */
+    for (int r = 0; r < topo.nr_ranks; r++) {
+        uint32_t first = topo.rank_first_dpu[r], end = topo.rank_first_dpu[r + 1];
+#ifdef RANK_ORIENTED_XFER
+        int max_reqs = 0;
+        for (uint32_t dpu = first; dpu < end; dpu++)
+            max_reqs = std::max(max_reqs, batch_ctx.key_index[dpu][NR_SEATS_IN_DPU]);
+#endif /* RANK_ORIENTED_XFER */
+        assert(max_reqs <= MAX_REQ_NUM_IN_A_DPU);
+        RankArena& a = buf.arenas[r];
+        reserve_arena(a, r, (size_t)max_reqs * (end - first));
+        for (uint32_t dpu = first; dpu < end; dpu++) {
+            buf.requests[dpu] = (each_request_t*)a.requests.addr + (size_t)max_reqs * (dpu - first);
+            buf.results[dpu].ptr = a.results.addr + RESULT_ENTRY_SIZE * max_reqs * (dpu - first);
+        }
+    }
+}
+
 void upmem_send_task(const uint64_t task, BatchCtx& batch_ctx,
                      float* send_time, float* exec_time)
+{
+    upmem_launch_task(task, batch_ctx, send_time);
+    upmem_wait_task(exec_time);
+}
+
+void upmem_launch_task(const uint64_t task, BatchCtx& batch_ctx,
+                       float* send_time)
+{
+    upmem_send_requests(task, batch_ctx, send_time);
+    upmem_launch(task);
+}
+
+void upmem_send_requests(const uint64_t task, BatchCtx& batch_ctx,
+                         float* send_time)
 {
     struct timeval start, end;
 
@@ -336,9 +637,6 @@ void upmem_send_task(const uint64_t task, BatchCtx& batch_ctx,
 
     gettimeofday(&start, NULL);
 
-    /* send task ID */
-    broadcast(dpu_set, "task_no", &task, sizeof(uint64_t));
-
     /* send data */
     switch (task) {
     case TASK_INIT:
@@ -355,18 +653,18 @@ void upmem_send_task(const uint64_t task, BatchCtx& batch_ctx,
             size_t nr_reqs = batch_ctx.key_index[i][NR_SEATS_IN_DPU];
             send_bytes[i] = nr_reqs * sizeof(each_request_t);
         }
-        SEND_FOREACH(dpu_set, "end_idx",
-                     sizeof(int) * NR_SEATS_IN_DPU,
-                     batch_ctx.key_index);
-        SEND_FOREACH_VA(dpu_set, "request_buffer",
-                        dpu_requests, send_bytes);
+        SEND_FOREACH_SLOT(dpu_set, "end_idx", sizeof(int) * NR_SEATS_IN_DPU,
+                          sizeof(int) * NR_SEATS_IN_DPU,
+                          batch_ctx.key_index);
+        SEND_FOREACH_VA_SLOT(dpu_set, "request_buffer", sizeof(dpu_requests_t),
+                             dpu_requests, send_bytes);
 #else /* RANK_ORIENTED_XFER */
-        SEND_FOREACH(dpu_set, "end_idx",
-                     sizeof(int) * NR_SEATS_IN_DPU,
-                     batch_ctx.key_index);
-        SEND_FOREACH(dpu_set, "request_buffer",
-                     sizeof(each_request_t) * batch_ctx.send_size,
-                     dpu_requests);
+        SEND_FOREACH_SLOT(dpu_set, "end_idx", sizeof(int) * NR_SEATS_IN_DPU,
+                          sizeof(int) * NR_SEATS_IN_DPU,
+                          batch_ctx.key_index);
+        SEND_FOREACH_PTR_SLOT(dpu_set, "request_buffer", sizeof(dpu_requests_t),
+                              sizeof(each_request_t) * batch_ctx.send_size,
+                              dpu_requests);
 #endif /* RANK_ORIENTED_XFER */
         break;
     }
@@ -383,21 +681,41 @@ void upmem_send_task(const uint64_t task, BatchCtx& batch_ctx,
 #ifdef PRINT_DEBUG
     printf("send task [%s] done; %0.5f sec\n",
            task_name(task), time_diff(&start, &end));
+#endif /* PRINT_DEBUG */
+}
+
+void upmem_launch(const uint64_t task)
+{
+    uint64_t task_no = task;
+    if (task == TASK_GET || task == TASK_INSERT || task == TASK_SUCC)
+        task_no = TASK_WITH_OPERAND(task, current_slot);
+
+#ifdef PRINT_DEBUG
     printf("execute task [%s]\n", task_name(task));
 #endif /* PRINT_DEBUG */
 
-    gettimeofday(&start, NULL);
+    /* send task ID */
+    broadcast(dpu_set, "task_no", &task_no, sizeof(uint64_t));
+
+    gettimeofday(&launch_time, NULL);
 
     /* launch DPU */
-    execute(dpu_set);
+    execute_async(dpu_set);
+}
 
+void upmem_wait_task(float* exec_time)
+{
+    struct timeval end;
+
+    wait_dpus(dpu_set);
+
+    /* from the launch; includes the time the host was busy with other work */
     gettimeofday(&end, NULL);
     if (exec_time != NULL)
-        *exec_time = time_diff(&start, &end);
+        *exec_time = time_diff(&launch_time, &end);
 
 #ifdef PRINT_DEBUG
-    printf("execute task [%s] done; %0.5f sec\n",
-           task_name(task), time_diff(&start, &end));
+    printf("execute task done; %0.5f sec\n", time_diff(&launch_time, &end));
 #endif /* PRINT_DEBUG */
 }
 
@@ -419,10 +737,11 @@ void upmem_receive_get_results(BatchCtx& batch_ctx, float* receive_time)
         size_t nr_reqs = batch_ctx.key_index[i][NR_SEATS_IN_DPU];
         recv_bytes[i] = nr_reqs * sizeof(each_get_result_t);
     }
-    RECV_FOREACH_VA(dpu_set, "results", dpu_results, recv_bytes);
+    RECV_FOREACH_VA_SLOT(dpu_set, "results", sizeof(dpu_results_t),
+                         dpu_results, recv_bytes);
 #else /* RANK_ORIENTED_XFER */
-    RECV_FOREACH(dpu_set, "results",
-                 sizeof(each_get_result_t) * batch_ctx.send_size, dpu_results);
+    RECV_FOREACH_PTR_SLOT(dpu_set, "results", sizeof(dpu_results_t),
+                          sizeof(each_get_result_t) * batch_ctx.send_size, dpu_results);
 #endif /* RANK_ORIENTED_XFER */
 
     gettimeofday(&end, NULL);
@@ -448,10 +767,11 @@ void upmem_receive_succ_results(BatchCtx& batch_ctx, float* receive_time)
         size_t nr_reqs = batch_ctx.key_index[i][NR_SEATS_IN_DPU];
         recv_bytes[i] = nr_reqs * sizeof(each_succ_result_t);
     }
-    RECV_FOREACH_VA(dpu_set, "results", dpu_results, recv_bytes);
+    RECV_FOREACH_VA_SLOT(dpu_set, "results", sizeof(dpu_results_t),
+                         dpu_results, recv_bytes);
 #else /* RANK_ORIENTED_XFER */
-    RECV_FOREACH(dpu_set, "results",
-                 sizeof(each_succ_result_t) * batch_ctx.send_size, dpu_results);
+    RECV_FOREACH_PTR_SLOT(dpu_set, "results", sizeof(dpu_results_t),
+                          sizeof(each_succ_result_t) * batch_ctx.send_size, dpu_results);
 #endif /* RANK_ORIENTED_XFER */
 
     gettimeofday(&end, NULL);
@@ -508,14 +828,14 @@ void upmem_send_nodes_from_dpu_to_dpu(uint32_t from_DPU, seat_id_t from_tree,
     execute(dpu);
     RECV_SINGLE(dpu, "tree_transfer_num", sizeof(uint64_t), &n);
     RECV_SINGLE(dpu, "tree_transfer_buffer",
-                n * sizeof(KVPair), &tree_migration_buffer);
+                n * sizeof(KVPair), tree_migration_buffer);
     
     select_dpu(&dpu, to_DPU);
     task = TASK_WITH_OPERAND(TASK_TO, to_tree);
     SEND_SINGLE(dpu, "task_no", sizeof(uint64_t), &task);
     SEND_SINGLE(dpu, "tree_transfer_num", sizeof(uint64_t), &n);
     SEND_SINGLE(dpu, "tree_transfer_buffer",
-                n * sizeof(KVPair), &tree_migration_buffer);
+                n * sizeof(KVPair), tree_migration_buffer);
     execute(dpu);
 }
 
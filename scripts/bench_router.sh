@@ -0,0 +1,14 @@
+#!/bin/bash
+# compare routing structures (-r) of the host application
+# usage: bash scripts/bench_router.sh [host_app args...]
+
+cd $(dirname $0)/..
+echo cd $(pwd)
+HOST_APP=${HOST_APP:-./build/host/host_app_host_only}
+routers=(map index learned)
+
+echo "router, total_num_keys, preprocess_time1, preprocess_time2, batch_time, route_ns_per_key"
+for r in "${routers[@]}"
+do
+    $HOST_APP -r $r "$@" | grep total | awk -F', *' -v r=$r '{print r ", " $5 ", " $7 ", " $8 ", " $15 ", " $17}'
+done